@@ -1,3 +1,4 @@
+#define _GNU_SOURCE
 #include <stdio.h>
 #include <stdlib.h>
 #include <unistd.h>
@@ -7,14 +8,86 @@
 #include <sys/select.h>
 #include <sys/ioctl.h>
 #include <string.h>
+#include <stdarg.h>
+#include <pthread.h>
+#include <errno.h>
+#include <signal.h>
+#include <sys/epoll.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <sys/resource.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <sys/uio.h>
+#include <sys/wait.h>
+#include <sys/stat.h>
+#include <limits.h>
+#include <poll.h>
+#include <sched.h>
+#include <linux/io_uring.h>
+#include <linux/perf_event.h>
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#endif
 
 int override_width = 0;
 int override_height = 0;
+const char* record_path = NULL;
+const char* replay_path = NULL;
+const char* export_cast_path = NULL;
+long long replay_start_tick = 0;
+int keyframe_interval = 1000;
+int checksum_interval = 100;
+const char* serve_address = NULL;
+int render_profile_given = 0;
+int use_io_uring = 0;
+volatile sig_atomic_t server_stop = 0;
+const char* export_ppm_dir = NULL;
+const char* export_y4m_path = NULL;
+int export_cell_size = 8;
+int worker_threads = 0;
+long long batch_games = 0;
+int swarm_snakes = 0;
+int huge_pages = 0;
+long long swarm_ticks = 1000;
+int autopilot_policy = -1;
+long long decision_budget_us = 0;
+const char* bot_cmd = NULL;
+int bot_shared = 0;
+int solve_board = 0;
+int use_perf_counters = 0;
+int pty_bench_keys = 0;
+long long sixel_check_ticks = 0;
+int cell_size_given = 0;
+const char* dataset_dir = NULL;
+unsigned long long game_seed = 0;
+int seed_given = 0;
 enum GameMode {
     MODE_REGULAR = 0,
     MODE_GREEDY = 1
 };
 
+enum HugePages {
+    HUGE_PAGES_AUTO = 0,
+    HUGE_PAGES_THP = 1,
+    HUGE_PAGES_OFF = 2
+};
+
+enum BoardMemory {
+    BOARD_MEMORY_HEAP = 0,
+    BOARD_MEMORY_PAGES = 1,
+    BOARD_MEMORY_THP = 2,
+    BOARD_MEMORY_HUGETLB = 3
+};
+
+enum RenderProfile {
+    RENDER_FULL = 0,
+    RENDER_BANDWIDTH = 1,
+    RENDER_SIXEL = 2
+};
+
 typedef struct {
     int board_width;
     int board_height;
@@ -25,6 +98,7 @@ typedef struct {
     int wraparound_mode;
     int emoji_mode;
     enum GameMode game_mode;
+    enum RenderProfile render_profile;
 } Config;
 
 Config config = {
@@ -36,7 +110,8 @@ Config config = {
     .move_interval = 166667,
     .wraparound_mode = 0,
     .emoji_mode = 0,
-    .game_mode = MODE_REGULAR
+    .game_mode = MODE_REGULAR,
+    .render_profile = RENDER_FULL
 };
 
 #define EMOJI_SNAKE_HEAD "🐍"
@@ -50,26 +125,707 @@ Config config = {
 #define TERMINAL_HEIGHT_MARGIN 6
 #define POINTS_PER_FOOD 10
 #define FOOD_PLACEMENT_MAX_ATTEMPTS_MULTIPLIER 2
+#define HELP_LINE "Use WASD or arrow keys to move, SPACE to pause, Q to quit"
+
+#define REPLAY_MAGIC "SNKR"
+#define REPLAY_VERSION 3
+#define REPLAY_HEADER_SIZE 32
+#define REPLAY_INDEX_MAGIC "SNKI"
+#define REPLAY_TRAILER_SIZE 12
+#define REPLAY_TAG_KEYFRAME 'K'
+#define REPLAY_TAG_INDEX 'I'
+#define REPLAY_TAG_CHECKSUM 'C'
+#define KEYFRAME_FIXED_SIZE 41
+#define KEYFRAME_STREAM_RATIO 4
+#define REPLAY_SEEK_SECONDS 10
+#define EXPORT_SLOTS_PER_THREAD 2
+#define ARENA_ALIGN 64
+#define BATCH_MAX_TICKS_PER_CELL 64
+#define PILOT_HISTOGRAM_BUCKETS 24
+#define PILOT_DEADLINE_CHECK 1024
+#define BOT_MAGIC 0x424B4E53u
+#define BOT_VERSION 2
+#define BOT_FLAG_WRAPAROUND 1
+#define BOT_FLAG_GREEDY 2
+#define BOT_FLAG_SHARED 4
+#define BOT_SHARED_FD 3
+#define BOT_SPIN_LIMIT 256
+#define DATASET_BLOCK_BYTES (1 << 20)
+#define SOLVE_DEFAULT_SIZE 5
+#define SOLVE_MAX_CELLS 64
+#define SOLVE_MIN_WIDTH 4
+#define SOLVE_MEMO_SIZE (1 << 20)
+#define SOLVE_TASKS_PER_THREAD 64
+#define SOLVE_MAX_SPLIT_DEPTH 12
+#define SWARM_TILE_BITS 6
+#define SWARM_TILE_SIZE (1 << SWARM_TILE_BITS)
+#define SWARM_DEFAULT_SIZE 1024
+#define SWARM_START_LENGTH 3
+#define SWARM_TURN_ODDS 16
+#define SWARM_SPAWN_ATTEMPTS 64
+#define SWARM_WALL 0xFFFFFFFFu
+#define VIEW_WIDTH 78
+#define VIEW_HEIGHT 20
+#define VIEW_HELP_LINE "Use WASD or arrow keys to pan the view, Q to quit"
+#define FRAME_BAND_MIN_CELLS 65536
+#define FRAME_BAND_MIN_ROWS 16
+#define SIXEL_COLORS 5
+#define SIXEL_BAND_ROWS 6
+#define SIXEL_HEADER_SIZE 256
+#define SIXEL_DEFAULT_WIDTH 1024
+#define SERVER_MAX_EVENTS 256
+#define SERVER_READ_SIZE 256
+#define SESSION_MAX_PENDING 65536
+#define SERVER_ACCEPT_BACKOFF_US 100000
+#define COMMAND_QUEUE_SIZE 64
+#define COMMAND_KEYS "wasdWASDqQ "
+#define CONTROL_KEYS "qQ "
+#define DIRECTION_KEYS "wsad"
+#define URING_ENTRIES 4096
+#define SNAKE_CHUNK_BITS 10
+#ifdef BOARD_LAYOUT_TILED
+#define BOARD_TILE_BITS 3
+#define BOARD_TILE_SIZE (1 << BOARD_TILE_BITS)
+#define BOARD_LAYOUT_NAME "tiled 8x8"
+#else
+#define BOARD_LAYOUT_NAME "row-major"
+#endif
+#define HUGE_PAGE_SIZE ((size_t)2 << 20)
+#define BOARD_HEADER_SIZE 64
+#define SNAKE_CHUNK_SIZE (1 << SNAKE_CHUNK_BITS)
+#define TIMER_WHEEL_RESOLUTION_US 1000
+#define TIMER_WHEEL_LEVELS 4
+#define TIMER_WHEEL_BITS 6
+#define TIMER_WHEEL_SLOTS (1 << TIMER_WHEEL_BITS)
+#define URING_OP_ACCEPT 1
+#define URING_OP_RECV 2
+#define URING_OP_SEND 3
+#define URING_OP_MASK 3
+#define PTY_BENCH_COLS 120
+#define PTY_BENCH_ROWS 40
+#define PTY_BENCH_RUN_US 250000
+#define PTY_BENCH_PAUSE_US 50000
+#define PTY_BENCH_TIMEOUT_US 2000000
+#define PTY_BENCH_TURN_MOVES 3
 
 typedef struct {
     int x, y;
 } Point;
 
 typedef struct {
-    Point* body;
-    int length;
-    int max_length;
+    unsigned char* base;
+    size_t size;
+    size_t used;
+} Arena;
+
+typedef struct {
+    Point** chunks;
+    Point* spare;
+    Arena* arena;
+    long long chunk_count;
+    long long head;
+    long long length;
+    long long max_length;
     int direction;
 } Snake;
 
+enum Cell {
+    CELL_EMPTY = 0,
+    CELL_BODY = 1,
+    CELL_HEAD = 2,
+    CELL_FOOD = 3,
+    CELL_WALL = 4
+};
+
 typedef struct {
     Point food;
     Snake snake;
+    unsigned char* grid;
     int score;
     int game_over;
     int paused;
+    unsigned long long rng_state;
 } Game;
 
+typedef struct {
+    unsigned int magic;
+    unsigned int version;
+    unsigned int width;
+    unsigned int height;
+    unsigned int flags;
+    unsigned int length;
+} BotHello;
+
+typedef struct {
+    unsigned int tick;
+    unsigned int game_over;
+    unsigned int score;
+    unsigned int direction;
+    unsigned int length;
+    unsigned int head_x;
+    unsigned int head_y;
+    unsigned int food_x;
+    unsigned int food_y;
+} BotState;
+
+typedef struct {
+    unsigned int tick;
+    unsigned int direction;
+} BotAction;
+
+typedef struct {
+    BotHello hello;
+    unsigned int capacity;
+    unsigned int state_seq __attribute__((aligned(64)));
+    unsigned int body_head;
+    BotState state;
+    unsigned int action_seq __attribute__((aligned(64)));
+    BotAction action;
+    unsigned int body[][2] __attribute__((aligned(64)));
+} BotShared;
+
+typedef struct {
+    pid_t pid;
+    int to_bot;
+    int from_bot;
+    BotShared* shared;
+    size_t shared_size;
+    Point last_head;
+    unsigned int tick;
+    BotAction reply;
+    size_t reply_len;
+    int failed;
+} Bot;
+
+typedef struct {
+    unsigned long long mask;
+    unsigned long long rng_state;
+    int head;
+    int food;
+} SolveState;
+
+typedef struct {
+    unsigned long long mask;
+    unsigned long long rng_state;
+    unsigned char head;
+    unsigned char food;
+    unsigned char foods;
+    unsigned char won;
+    unsigned char move;
+} SolveEntry;
+
+typedef struct {
+    unsigned long long mask;
+    unsigned char head;
+    unsigned char fillable;
+} FillEntry;
+
+typedef struct {
+    SolveState state;
+    int foods;
+    int won;
+    int ended;
+    int depth;
+    unsigned char path[SOLVE_MAX_SPLIT_DEPTH];
+} SolveTask;
+
+typedef struct {
+    pthread_t thread;
+    struct Solver* solver;
+    SolveEntry* memo;
+    FillEntry* fill_memo;
+    long long states;
+    long long hits;
+} SolveWorker;
+
+typedef struct Solver {
+    Config* cfg;
+    int width;
+    int height;
+    int cells;
+    unsigned long long full_mask;
+    signed char neighbors[SOLVE_MAX_CELLS][4];
+    unsigned char transforms[8][SOLVE_MAX_CELLS];
+    int transform_count;
+    SolveTask* tasks;
+    int task_count;
+    int next_task;
+} Solver;
+
+struct Pilot;
+
+typedef struct {
+    const char* name;
+    int (*decide)(struct Pilot *pilot, Game *game, Config* cfg, long long deadline_us);
+} Policy;
+
+typedef struct Pilot {
+    const Policy* policy;
+    long long budget_us;
+    long long decisions;
+    long long overruns;
+    long long total_us;
+    long long max_us;
+    long long histogram[PILOT_HISTOGRAM_BUCKETS];
+    unsigned char* first_step;
+    unsigned int* queue;
+    size_t queued;
+    Bot* bot;
+} Pilot;
+
+enum PerfPhase {
+    PERF_PHASE_TICK = 0,
+    PERF_PHASE_FOOD = 1,
+    PERF_PHASE_RENDER = 2,
+    PERF_PHASE_COUNT = 3
+};
+
+enum PerfEvent {
+    PERF_CYCLES = 0,
+    PERF_INSTRUCTIONS = 1,
+    PERF_CACHE_MISSES = 2,
+    PERF_BRANCH_MISSES = 3,
+    PERF_EVENT_COUNT = 4
+};
+
+typedef struct {
+    int fds[PERF_EVENT_COUNT];
+    unsigned long long ids[PERF_EVENT_COUNT];
+    unsigned long long last[PERF_EVENT_COUNT];
+    unsigned long long totals[PERF_PHASE_COUNT][PERF_EVENT_COUNT];
+    long long calls[PERF_PHASE_COUNT];
+    int stack[PERF_PHASE_COUNT];
+    int depth;
+    unsigned long long time_enabled;
+    unsigned long long time_running;
+} PerfCounters;
+
+typedef struct {
+    const char* text;
+    int length;
+    int matched;
+} PtyMatch;
+
+typedef struct {
+    int escape;
+    int params[2];
+    int param_count;
+    int row;
+    int col;
+    int head_row;
+    int head_col;
+    int want_dx;
+    int want_dy;
+} PtyScreen;
+
+typedef struct {
+    int master;
+    pid_t pid;
+    long long bytes;
+    int ended;
+    PtyScreen screen;
+    PtyMatch paused;
+    PtyMatch game_over;
+    PtyMatch prompt;
+} PtyBench;
+
+typedef struct {
+    int state;
+} KeyDecoder;
+
+typedef struct {
+    size_t sequence;
+    long long time_us;
+    int key;
+} Command;
+
+typedef struct {
+    Command slots[COMMAND_QUEUE_SIZE];
+    size_t enqueue_pos;
+    size_t dequeue_pos;
+    size_t max_depth;
+    long long drops;
+} CommandQueue;
+
+typedef struct {
+    CommandQueue* queue;
+    pthread_t thread;
+    int stop[2];
+    int wake[2];
+    int steer;
+    int pauses;
+    int quit;
+} KeyReader;
+
+typedef struct {
+    char* data;
+    size_t len;
+    size_t cap;
+} OutBuf;
+
+typedef struct {
+    pthread_t thread;
+    struct FramePool* pool;
+    int row_start;
+    int row_end;
+    OutBuf out;
+} FrameBand;
+
+typedef struct FramePool {
+    FrameBand* bands;
+    int band_count;
+    int stopping;
+    int pending;
+    pthread_barrier_t start;
+    pthread_barrier_t done;
+    Config* cfg;
+    const unsigned char* cells;
+    const char* newline;
+    OutBuf tail;
+} FramePool;
+
+typedef struct {
+    int cell_size;
+    int width;
+    int height;
+    int image_width;
+    int image_height;
+    int band_count;
+    unsigned char* grid;
+    unsigned char* row_changed;
+    unsigned char* masks;
+    OutBuf header;
+    OutBuf* bands;
+    long long bands_encoded;
+} SixelCache;
+
+typedef struct {
+    unsigned char* cells;
+    FramePool* bands;
+    SixelCache* sixel;
+    const char* newline;
+    enum RenderProfile profile;
+    int width;
+    int height;
+    int has_frame;
+    int score;
+    int paused;
+    int status_len;
+    int cursor_row;
+    int cursor_col;
+    long long frames;
+    long long bytes;
+} Renderer;
+
+typedef struct {
+    long long* ticks;
+    long long* offsets;
+    int count;
+    int cap;
+} KeyframeIndex;
+
+typedef struct {
+    FILE* file;
+    const char* path;
+    long long tick;
+    long long last_keyframe_tick;
+    KeyframeIndex index;
+} ReplayWriter;
+
+typedef struct {
+    FILE* file;
+    long long tick;
+    long long total_ticks;
+    KeyframeIndex index;
+    int board_width;
+    int board_height;
+    int move_fps;
+    int wraparound_mode;
+    enum GameMode game_mode;
+    unsigned long long seed;
+    long long checksums;
+    long long diverged_tick;
+} ReplayReader;
+
+typedef struct Timer {
+    struct Timer* next;
+    struct Timer* prev;
+    long long expires;
+    void* owner;
+    int kind;
+    int level;
+    int slot;
+} Timer;
+
+typedef struct {
+    Timer slots[TIMER_WHEEL_LEVELS][TIMER_WHEEL_SLOTS];
+    unsigned long long occupied[TIMER_WHEEL_LEVELS];
+    long long current;
+    int count;
+} TimerWheel;
+
+enum SessionTimer {
+    TIMER_MOVE = 0,
+    TIMER_RENDER = 1,
+    TIMER_SWARM = 2,
+    TIMER_ACCEPT = 3
+};
+
+typedef struct Session {
+    int fd;
+    int index;
+    Game game;
+    Renderer renderer;
+    KeyDecoder keys;
+    CommandQueue commands;
+    long long commands_applied;
+    long long command_wait_us;
+    OutBuf out;
+    size_t out_sent;
+    Timer move_timer;
+    Timer render_timer;
+    struct Session* dirty_next;
+    int dirty;
+    long long started;
+    long long bytes_sent;
+    int want_write;
+    int closing;
+    int recv_inflight;
+    int send_inflight;
+    int shut_down;
+    int view_x;
+    int view_y;
+    size_t* view_pending;
+    size_t view_pending_count;
+    unsigned char* view_marked;
+    unsigned char in_buf[SERVER_READ_SIZE];
+} Session;
+
+typedef struct {
+    Session** sessions;
+    int count;
+    int cap;
+} TileSubscribers;
+
+typedef struct {
+    int fd;
+    unsigned* sq_head;
+    unsigned* sq_tail;
+    unsigned* sq_mask;
+    unsigned* sq_array;
+    unsigned* cq_head;
+    unsigned* cq_tail;
+    unsigned* cq_mask;
+    struct io_uring_sqe* sqes;
+    struct io_uring_cqe* cqes;
+    unsigned sq_entries;
+    unsigned sq_local_tail;
+    unsigned to_submit;
+    void* sq_ring;
+    size_t sq_ring_size;
+    void* cq_ring;
+    size_t cq_ring_size;
+    size_t sqes_size;
+} Uring;
+
+typedef struct {
+    Config* cfg;
+    int epoll_fd;
+    int listen_fd;
+    unsigned char* cells;
+    Session** sessions;
+    int session_count;
+    int session_cap;
+    Session* dirty_head;
+    TimerWheel timers;
+    long long now;
+    long long sessions_served;
+    long long bytes_sent;
+    long long session_us;
+    long long commands_applied;
+    long long command_wait_us;
+    long long command_drops;
+    size_t command_max_depth;
+    unsigned long long seed;
+    struct Swarm* swarm;
+    TileSubscribers* subscribers;
+    Timer swarm_timer;
+    Timer accept_timer;
+    int accept_resume;
+    int view_width;
+    int view_height;
+    long long view_changes;
+} Server;
+
+enum ExportFormat {
+    EXPORT_PPM = 0,
+    EXPORT_Y4M = 1
+};
+
+enum SlotState {
+    SLOT_FREE = 0,
+    SLOT_READY = 1,
+    SLOT_BUSY = 2,
+    SLOT_DONE = 3
+};
+
+typedef struct {
+    unsigned char* cells;
+    unsigned char* pixels;
+    long long frame;
+    enum SlotState state;
+} ExportSlot;
+
+typedef struct {
+    Config* cfg;
+    enum ExportFormat format;
+    FILE* stream;
+    int cell_size;
+    int image_width;
+    int image_height;
+    size_t frame_bytes;
+    unsigned char palette[5][3];
+    ExportSlot* slots;
+    int slot_count;
+    long long next_claim;
+    int done;
+    int write_failed;
+    pthread_mutex_t lock;
+    pthread_cond_t changed;
+} ImageExport;
+
+enum DatasetColumn {
+    DATASET_GAME,
+    DATASET_TICK,
+    DATASET_HEAD_X,
+    DATASET_HEAD_Y,
+    DATASET_FOOD_X,
+    DATASET_FOOD_Y,
+    DATASET_LENGTH,
+    DATASET_DIRECTION,
+    DATASET_ACTION,
+    DATASET_REWARD,
+    DATASET_DONE,
+    DATASET_BOARD,
+    DATASET_COLUMNS
+};
+
+typedef struct {
+    const char* name;
+    const char* type;
+    int width;
+} DatasetColumnInfo;
+
+typedef struct {
+    const char* dir;
+    int fds[DATASET_COLUMNS];
+    int widths[DATASET_COLUMNS];
+    size_t cell_count;
+    int block_rows;
+    long long rows;
+    int failed;
+} Dataset;
+
+typedef struct {
+    unsigned char* columns[DATASET_COLUMNS];
+    unsigned char* cells;
+    int count;
+} DatasetBlock;
+
+typedef struct {
+    struct Batch* batch;
+    pthread_t thread;
+    pthread_mutex_t lock;
+    long long next_game;
+    long long end_game;
+    int index;
+    int cpu;
+    int failed;
+    Arena arena;
+    const char* memory;
+    long long games;
+    long long ticks;
+    long long score_total;
+    long long capped;
+    long long steals;
+    int best_score;
+    unsigned long long checksum;
+    DatasetBlock dataset;
+} __attribute__((aligned(64))) Shard;
+
+typedef struct Batch {
+    Config* cfg;
+    Shard* shards;
+    int shard_count;
+    unsigned long long seed;
+    long long max_ticks;
+    Dataset* dataset;
+} Batch;
+
+enum SwarmFate {
+    SWARM_DIE = 0,
+    SWARM_PENDING = 1,
+    SWARM_MOVE = 2,
+    SWARM_EAT = 3
+};
+
+typedef struct {
+    unsigned int* body;
+    int head;
+    int length;
+    int capacity;
+    int direction;
+    int grow;
+    int alive;
+    int score;
+    enum SwarmFate fate;
+    unsigned int target;
+    unsigned long long rng_state;
+} SwarmSnake;
+
+typedef struct {
+    struct Swarm* swarm;
+    pthread_t thread;
+    int index;
+    int cpu;
+    int first_snake;
+    int end_snake;
+    int first_tile;
+    int end_tile;
+    int* tile_start;
+    int* tile_fill;
+    int* intents;
+    unsigned short* claims;
+    unsigned int* changes;
+    int change_count;
+    int change_cap;
+    long long moves;
+    long long eaten;
+    long long deaths;
+} __attribute__((aligned(64))) SwarmWorker;
+
+typedef struct Swarm {
+    Config* cfg;
+    unsigned char* grid;
+    SwarmSnake* snakes;
+    int snake_count;
+    int food_target;
+    int food_count;
+    int tiles_x;
+    int tiles_y;
+    int tile_count;
+    SwarmWorker* workers;
+    int worker_count;
+    pthread_barrier_t barrier;
+    unsigned long long rng_state;
+    int track_changes;
+    int stopping;
+    long long ticks;
+    long long moves;
+    long long eaten;
+    long long deaths;
+} Swarm;
+
 enum Direction {
     UP = 1,
     DOWN = 2,
@@ -110,6 +866,21 @@ int kbhit() {
     return 0;
 }
 
+long long monotonic_us() {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return now.tv_sec * 1000000LL + now.tv_nsec / 1000LL;
+}
+
+long long wait_for_input(int fd) {
+    long long started = monotonic_us();
+    struct pollfd pfd = {fd, POLLIN, 0};
+    if (fd != STDIN_FILENO || !kbhit()) {
+        poll(&pfd, 1, -1);
+    }
+    return monotonic_us() - started;
+}
+
 void clear_screen() {
     printf("\033[2J\033[H");
 }
@@ -138,6 +909,52 @@ void print_usage(const char* program_name) {
     printf("  --mode MODE   Set game mode: regular, greedy (default: regular)\n");
     printf("  --wraparound  Enable wraparound mode (walls teleport to opposite side)\n");
     printf("  --emoji       Enable emoji mode (use emojis for game elements)\n");
+    printf("  --render-profile P  full (repaint every frame) or bandwidth (send only changes)\n");
+    printf("                      (default: full, bandwidth for --serve)\n");
+    printf("  --sixel       Draw the board as a sixel image, re-encoding only the pixel bands that changed\n");
+    printf("                (cells are --cell-size pixels; by default 8, shrinking down to 1 so the image\n");
+    printf("                stays within 1024 pixels wide where the board allows)\n");
+    printf("  --sixel-check N  Render N ticks of a greedy autopilot game as sixel (--seed 1 unless given),\n");
+    printf("                decode every frame and compare it pixel by pixel with the board\n");
+    printf("  --record FILE Record the game to a replay file\n");
+    printf("  --replay FILE Play back a recorded game (with --record, rewrite it in the current format)\n");
+    printf("  --seek TICK   Start replay playback at the given tick\n");
+    printf("  --keyframe-interval N  Ticks between replay keyframes used for seeking (default: 1000)\n");
+    printf("  --checksum-interval N  Ticks between recorded state checksums checked on replay (default: 100)\n");
+    printf("  --export-cast FILE  With --replay, export an asciinema v2 recording\n");
+    printf("  --export-ppm DIR    With --replay, export one PPM image per tick into DIR\n");
+    printf("  --export-y4m FILE   With --replay, export an uncompressed YUV4MPEG2 video\n");
+    printf("  --cell-size PX      Pixel size of one board cell in image exports and --sixel (default: 8,\n");
+    printf("                      shrinking for wide boards with --sixel)\n");
+    printf("  --threads N         Worker threads for exports, frame bands and batch shards (default: CPU count)\n");
+    printf("  --autopilot POLICY  Let a bot steer the snake: greedy or search (default: off)\n");
+    printf("  --decision-budget US  Time budget per autopilot move; overruns fall back to the greedy move\n");
+    printf("                      (default: half the move interval)\n");
+    printf("  --bot-cmd CMD Let an external program steer the snake, exchanging binary state and moves\n");
+    printf("                over its stdin/stdout once per tick (the decision budget applies)\n");
+    printf("  --bot-shm     With --bot-cmd, exchange ticks through shared memory on fd 3 instead\n");
+    printf("  --solve       Search every move sequence of a small greedy board (at most %d cells, default: %dx%d)\n",
+           SOLVE_MAX_CELLS, SOLVE_DEFAULT_SIZE, SOLVE_DEFAULT_SIZE);
+    printf("                for the best score and whether it can be won; --record saves the best line\n");
+    printf("  --batch N     Play N headless autopilot games on core-pinned shards and report totals\n");
+    printf("  --dump-dataset DIR  With --batch, write (state, action, reward) samples as one binary file\n");
+    printf("                      per fixed-width column, described by DIR/schema.txt\n");
+    printf("  --swarm N     Simulate N autopilot snakes sharing one board (default board: %dx%d)\n",
+           SWARM_DEFAULT_SIZE, SWARM_DEFAULT_SIZE);
+    printf("  --ticks N     Ticks to simulate with --swarm (default: 1000)\n");
+    printf("                With --serve, the swarm runs until stopped and clients pan a viewport over it\n");
+    printf("  --seed N      Seed food placement (default: current time)\n");
+    printf("  --huge-pages MODE   Back large boards with huge pages: auto (hugetlb, then transparent),\n");
+    printf("                      thp (transparent only) or off (default: auto)\n");
+    printf("  --serve ADDR  Host independent games for many clients on a Unix socket path,\n");
+    printf("                or on a localhost TCP port if ADDR is a number\n");
+    printf("  --io-uring    With --serve, batch socket I/O through io_uring (falls back to epoll)\n");
+    printf("  --perf-counters  Count cycles, instructions, cache and branch misses of the tick, food\n");
+    printf("                placement and render phases of a game or replay and report them at exit\n");
+    printf("  --pty-bench N Run the game in a pseudo-terminal, press SPACE N times and report key-to-screen\n");
+    printf("                latency and output bytes/s (the game gets the other options, plus a greedy\n");
+    printf("                autopilot and --seed 1 unless given), then replay it without the autopilot\n");
+    printf("                and time N turns until the head moves the new way\n");
     printf("  --help        Show this help message\n");
     printf("\nNote: For best visual experience, use a width:height ratio of approximately 2:1\n");
     printf("      (e.g., -w 40 -h 20 or -w 60 -h 30)\n");
@@ -169,258 +986,5728 @@ void get_terminal_size(Config* cfg) {
     }
 }
 
-void init_game(Game *game, Config* cfg) {
-    get_terminal_size(cfg);
-    
-    int max_possible_length = cfg->board_width * cfg->board_height;
-    game->snake.body = malloc(max_possible_length * sizeof(Point));
-    game->snake.max_length = max_possible_length;
-    
-    game->snake.length = 3;
-    game->snake.direction = RIGHT;
-    game->snake.body[0].x = cfg->board_width / 2;
-    game->snake.body[0].y = cfg->board_height / 2;
-    game->snake.body[1].x = game->snake.body[0].x - 1;
-    game->snake.body[1].y = game->snake.body[0].y;
-    game->snake.body[2].x = game->snake.body[0].x - 2;
-    game->snake.body[2].y = game->snake.body[0].y;
-    
-    game->score = 0;
-    game->game_over = 0;
-    game->paused = 0;
-    
-    srand(time(NULL));
-    game->food.x = rand() % cfg->board_width;
-    game->food.y = rand() % cfg->board_height;
+void seed_game_state(unsigned long long *state, unsigned long long seed) {
+    *state = seed ^ 0x9E3779B97F4A7C15ULL;
+    if (*state == 0) {
+        *state = 1;
+    }
 }
 
-void cleanup_game(Game *game) {
-    if (game->snake.body) {
-        free(game->snake.body);
-        game->snake.body = NULL;
-    }
+void seed_game(Game *game, unsigned long long seed) {
+    seed_game_state(&game->rng_state, seed);
 }
 
-void draw_board(Game *game, Config* cfg) {
-    printf("\033[H");
-    
-    if (game->paused) {
-        printf("Score: %d - PAUSED (Press SPACE to resume)\n", game->score);
-    } else {
-        printf("Score: %d\n", game->score);
-    }
-    printf("\n");
+unsigned int rng_next(unsigned long long *state) {
+    unsigned long long x = *state;
+    x ^= x >> 12;
+    x ^= x << 25;
+    x ^= x >> 27;
+    *state = x;
+    return (unsigned int)((x * 0x2545F4914F6CDD1DULL) >> 33);
+}
+
+unsigned int game_rand(Game *game) {
+    return rng_next(&game->rng_state);
+}
+
+size_t cell_index(Config* cfg, Point p) {
+#ifdef BOARD_LAYOUT_TILED
+    size_t tiles_x = (size_t)(cfg->board_width + BOARD_TILE_SIZE - 1) >> BOARD_TILE_BITS;
+    size_t tile = (size_t)(p.y >> BOARD_TILE_BITS) * tiles_x + (size_t)(p.x >> BOARD_TILE_BITS);
+    return tile << (2 * BOARD_TILE_BITS) | (size_t)(p.y & (BOARD_TILE_SIZE - 1)) << BOARD_TILE_BITS |
+           (size_t)(p.x & (BOARD_TILE_SIZE - 1));
+#else
+    return (size_t)p.y * cfg->board_width + p.x;
+#endif
+}
+
+Point cell_point(Config* cfg, size_t index) {
+#ifdef BOARD_LAYOUT_TILED
+    size_t tiles_x = (size_t)(cfg->board_width + BOARD_TILE_SIZE - 1) >> BOARD_TILE_BITS;
+    size_t tile = index >> (2 * BOARD_TILE_BITS);
+    Point p = {(int)((tile % tiles_x) << BOARD_TILE_BITS | (index & (BOARD_TILE_SIZE - 1))),
+               (int)((tile / tiles_x) << BOARD_TILE_BITS | ((index >> BOARD_TILE_BITS) & (BOARD_TILE_SIZE - 1)))};
+#else
+    Point p = {(int)(index % (size_t)cfg->board_width), (int)(index / (size_t)cfg->board_width)};
+#endif
+    return p;
+}
+
+size_t board_cells(Config* cfg) {
+#ifdef BOARD_LAYOUT_TILED
+    size_t tiles_x = (size_t)(cfg->board_width + BOARD_TILE_SIZE - 1) >> BOARD_TILE_BITS;
+    size_t tiles_y = (size_t)(cfg->board_height + BOARD_TILE_SIZE - 1) >> BOARD_TILE_BITS;
+    return tiles_x * tiles_y << (2 * BOARD_TILE_BITS);
+#else
+    return (size_t)cfg->board_width * cfg->board_height;
+#endif
+}
+
+void* board_alloc(size_t size) {
+    size_t total = (size + BOARD_HEADER_SIZE + HUGE_PAGE_SIZE - 1) & ~(HUGE_PAGE_SIZE - 1);
+    unsigned char* base = MAP_FAILED;
+    enum BoardMemory kind = BOARD_MEMORY_HEAP;
     
-    for (int y = -1; y <= cfg->board_height; y++) {
-        for (int x = -1; x <= cfg->board_width; x++) {
-            if (x == -1 || x == cfg->board_width || y == -1 || y == cfg->board_height) {
-                printf("%s", cfg->emoji_mode ? EMOJI_WALL : "#");
-            } else {
-                int is_snake = 0;
-                for (int i = 0; i < game->snake.length; i++) {
-                    if (game->snake.body[i].x == x && game->snake.body[i].y == y) {
-                        if (cfg->emoji_mode) {
-                            printf("%s", (i == 0) ? EMOJI_SNAKE_HEAD : EMOJI_SNAKE_BODY);
-                        } else {
-                            printf("%s", (i == 0) ? "@" : "o");
-                        }
-                        is_snake = 1;
-                        break;
-                    }
-                }
-                
-                if (!is_snake) {
-                    if (game->food.x == x && game->food.y == y) {
-                        printf("%s", cfg->emoji_mode ? EMOJI_FOOD : "*");
-                    } else {
-                        printf("%s", cfg->emoji_mode ? "  " : " ");
-                    }
+    if (size >= HUGE_PAGE_SIZE && huge_pages != HUGE_PAGES_OFF) {
+        if (huge_pages == HUGE_PAGES_AUTO) {
+            base = mmap(NULL, total, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+            kind = BOARD_MEMORY_HUGETLB;
+        }
+        if (base == MAP_FAILED) {
+            unsigned char* raw = mmap(NULL, total + HUGE_PAGE_SIZE, PROT_READ | PROT_WRITE,
+                                      MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+            if (raw != MAP_FAILED) {
+                base = (unsigned char*)(((uintptr_t)raw + HUGE_PAGE_SIZE - 1) & ~(uintptr_t)(HUGE_PAGE_SIZE - 1));
+                if (base > raw) {
+                    munmap(raw, (size_t)(base - raw));
                 }
+                munmap(base + total, (size_t)(raw + HUGE_PAGE_SIZE - base));
+                kind = madvise(base, total, MADV_HUGEPAGE) == 0 ? BOARD_MEMORY_THP : BOARD_MEMORY_PAGES;
             }
         }
-        printf("\n");
+    }
+    if (base == MAP_FAILED) {
+        total = size + BOARD_HEADER_SIZE;
+        base = calloc(1, total);
+        kind = BOARD_MEMORY_HEAP;
+        if (!base) {
+            return NULL;
+        }
     }
     
-    printf("\nUse WASD or arrow keys to move, SPACE to pause, Q to quit\n");
-    fflush(stdout);
+    ((size_t*)base)[0] = total;
+    ((size_t*)base)[1] = kind;
+    return base + BOARD_HEADER_SIZE;
 }
 
-void generate_food(Game *game, Config* cfg) {
-    int total_cells = cfg->board_width * cfg->board_height;
-    
-    if (game->snake.length >= total_cells) {
-        game->game_over = 1;
+enum BoardMemory board_memory(const void* p) {
+    return (enum BoardMemory)((const size_t*)((const unsigned char*)p - BOARD_HEADER_SIZE))[1];
+}
+
+const char* board_memory_name(const void* p) {
+    switch (board_memory(p)) {
+        case BOARD_MEMORY_HUGETLB:
+            return "hugetlb pages";
+        case BOARD_MEMORY_THP:
+            return "transparent huge pages";
+        case BOARD_MEMORY_PAGES:
+            return "4 KB pages";
+        default:
+            return "heap";
+    }
+}
+
+void board_free(void* p) {
+    if (!p) {
         return;
     }
-    
-    int valid = 0;
-    int attempts = 0;
-    while (!valid && attempts < total_cells * FOOD_PLACEMENT_MAX_ATTEMPTS_MULTIPLIER) {
-        game->food.x = rand() % cfg->board_width;
-        game->food.y = rand() % cfg->board_height;
-        
-        valid = 1;
-        for (int i = 0; i < game->snake.length; i++) {
-            if (game->snake.body[i].x == game->food.x && 
-                game->snake.body[i].y == game->food.y) {
-                valid = 0;
-                break;
-            }
+    unsigned char* base = (unsigned char*)p - BOARD_HEADER_SIZE;
+    if (board_memory(p) == BOARD_MEMORY_HEAP) {
+        free(base);
+    } else {
+        munmap(base, ((size_t*)base)[0]);
+    }
+}
+
+int arena_init(Arena *arena, size_t size) {
+    arena->base = board_alloc(size);
+    arena->size = arena->base ? size : 0;
+    arena->used = 0;
+    return arena->base ? 0 : -1;
+}
+
+void* arena_alloc(Arena *arena, size_t size) {
+    size_t offset = (arena->used + ARENA_ALIGN - 1) & ~(size_t)(ARENA_ALIGN - 1);
+    if (offset + size > arena->size) {
+        return NULL;
+    }
+    arena->used = offset + size;
+    return arena->base + offset;
+}
+
+void arena_free(Arena *arena) {
+    board_free(arena->base);
+    memset(arena, 0, sizeof(*arena));
+}
+
+size_t snake_arena_size(long long max_length) {
+    long long chunk_count = (max_length + SNAKE_CHUNK_SIZE - 1) >> SNAKE_CHUNK_BITS;
+    return chunk_count * (sizeof(Point*) + SNAKE_CHUNK_SIZE * sizeof(Point)) + (chunk_count + 1) * ARENA_ALIGN;
+}
+
+int snake_init(Snake *snake, long long max_length, Arena *arena) {
+    memset(snake, 0, sizeof(*snake));
+    snake->arena = arena;
+    snake->max_length = max_length;
+    snake->chunk_count = (max_length + SNAKE_CHUNK_SIZE - 1) >> SNAKE_CHUNK_BITS;
+    size_t table_size = snake->chunk_count * sizeof(Point*);
+    snake->chunks = arena ? arena_alloc(arena, table_size) : board_alloc(table_size);
+    return snake->chunks ? 0 : -1;
+}
+
+void snake_release_chunk(Snake *snake, long long chunk) {
+    if (!snake->spare || snake->arena) {
+        *(Point**)snake->chunks[chunk] = snake->spare;
+        snake->spare = snake->chunks[chunk];
+    } else {
+        free(snake->chunks[chunk]);
+    }
+    snake->chunks[chunk] = NULL;
+}
+
+Point* snake_slot(Snake *snake, long long index) {
+    Point** chunk = &snake->chunks[index >> SNAKE_CHUNK_BITS];
+    if (!*chunk) {
+        if (snake->spare) {
+            *chunk = snake->spare;
+            snake->spare = *(Point**)snake->spare;
+        } else if (snake->arena) {
+            *chunk = arena_alloc(snake->arena, SNAKE_CHUNK_SIZE * sizeof(Point));
+        } else {
+            *chunk = malloc(SNAKE_CHUNK_SIZE * sizeof(Point));
+        }
+        if (!*chunk) {
+            return NULL;
         }
-        attempts++;
     }
-    
-    if (!valid) {
-        game->game_over = 1;
+    return &(*chunk)[index & (SNAKE_CHUNK_SIZE - 1)];
+}
+
+Point snake_segment(Snake *snake, long long i) {
+    long long index = (snake->head + i) % snake->max_length;
+    return snake->chunks[index >> SNAKE_CHUNK_BITS][index & (SNAKE_CHUNK_SIZE - 1)];
+}
+
+int snake_push_head(Snake *snake, Point p) {
+    long long head = (snake->head + snake->max_length - 1) % snake->max_length;
+    Point* slot = snake_slot(snake, head);
+    if (!slot) {
+        return -1;
     }
+    *slot = p;
+    snake->head = head;
+    snake->length++;
+    return 0;
 }
 
-void move_snake(Game *game, Config* cfg) {
-    Point new_head = game->snake.body[0];
-    
-    switch (game->snake.direction) {
-        case UP:
-            new_head.y--;
-            break;
-        case DOWN:
-            new_head.y++;
-            break;
-        case LEFT:
-            new_head.x--;
-            break;
-        case RIGHT:
-            new_head.x++;
-            break;
+void snake_pop_tail(Snake *snake) {
+    snake->length--;
+    long long index = (snake->head + snake->length) % snake->max_length;
+    long long chunk = index >> SNAKE_CHUNK_BITS;
+    if ((index & (SNAKE_CHUNK_SIZE - 1)) == 0 &&
+        (snake->length == 0 || snake->head >> SNAKE_CHUNK_BITS != chunk)) {
+        snake_release_chunk(snake, chunk);
     }
-    
-    if (cfg->wraparound_mode) {
-        if (new_head.x < 0) {
-            new_head.x = cfg->board_width - 1;
-        } else if (new_head.x >= cfg->board_width) {
-            new_head.x = 0;
+}
+
+void snake_clear(Snake *snake) {
+    for (long long chunk = 0; chunk < snake->chunk_count; chunk++) {
+        if (snake->chunks[chunk]) {
+            snake_release_chunk(snake, chunk);
         }
-        
-        if (new_head.y < 0) {
-            new_head.y = cfg->board_height - 1;
-        } else if (new_head.y >= cfg->board_height) {
-            new_head.y = 0;
+    }
+    snake->head = 0;
+    snake->length = 0;
+}
+
+void snake_free(Snake *snake) {
+    if (snake->chunks && !snake->arena) {
+        snake_clear(snake);
+        free(snake->spare);
+        board_free(snake->chunks);
+    }
+    memset(snake, 0, sizeof(*snake));
+}
+
+void clear_snake_cells(Game *game, Config* cfg) {
+    for (long long i = 0; i < game->snake.length; i++) {
+        Point p = snake_segment(&game->snake, i);
+        if (p.x >= 0) {
+            game->grid[cell_index(cfg, p)] = CELL_EMPTY;
         }
-    } else {
-        if (new_head.x < 0 || new_head.x >= cfg->board_width || 
-            new_head.y < 0 || new_head.y >= cfg->board_height) {
-            game->game_over = 1;
-            return;
+    }
+}
+
+int reset_game(Game *game, Config* cfg, unsigned long long seed) {
+    clear_snake_cells(game, cfg);
+    snake_clear(&game->snake);
+    game->snake.direction = RIGHT;
+    for (int i = 0; i < 3; i++) {
+        Point p = {cfg->board_width / 2 - i, cfg->board_height / 2};
+        Point* slot = snake_slot(&game->snake, i);
+        if (!slot) {
+            return -1;
+        }
+        *slot = p;
+        game->snake.length = i + 1;
+        if (p.x >= 0) {
+            game->grid[cell_index(cfg, p)] = (i == 0) ? CELL_HEAD : CELL_BODY;
         }
     }
     
-    int ate_food = (new_head.x == game->food.x && new_head.y == game->food.y);
+    game->score = 0;
+    game->game_over = 0;
+    game->paused = 0;
     
-    for (int i = 1; i < game->snake.length; i++) {
-        if (game->snake.body[i].x == new_head.x && 
-            game->snake.body[i].y == new_head.y) {
+    seed_game(game, seed);
+    game->food.x = game_rand(game) % cfg->board_width;
+    game->food.y = game_rand(game) % cfg->board_height;
+    return 0;
+}
+
+void cleanup_game(Game *game) {
+    snake_free(&game->snake);
+    board_free(game->grid);
+    game->grid = NULL;
+}
+
+int init_game(Game *game, Config* cfg, unsigned long long seed) {
+    long long max_possible_length = (long long)cfg->board_width * cfg->board_height;
+    game->grid = NULL;
+    if (snake_init(&game->snake, max_possible_length, NULL) != 0 ||
+        !(game->grid = board_alloc(board_cells(cfg))) ||
+        reset_game(game, cfg, seed) != 0) {
+        cleanup_game(game);
+        return -1;
+    }
+    return 0;
+}
+
+void outbuf_reserve(OutBuf *buf, size_t extra) {
+    if (buf->len + extra <= buf->cap) {
+        return;
+    }
+    size_t cap = buf->cap ? buf->cap : 4096;
+    while (cap < buf->len + extra) {
+        cap *= 2;
+    }
+    buf->data = realloc(buf->data, cap);
+    buf->cap = cap;
+}
+
+void outbuf_write(OutBuf *buf, const char* data, size_t len) {
+    outbuf_reserve(buf, len);
+    memcpy(buf->data + buf->len, data, len);
+    buf->len += len;
+}
+
+void outbuf_puts(OutBuf *buf, const char* s) {
+    outbuf_write(buf, s, strlen(s));
+}
+
+void outbuf_printf(OutBuf *buf, const char* fmt, ...) {
+    va_list args;
+    va_start(args, fmt);
+    int needed = vsnprintf(NULL, 0, fmt, args);
+    va_end(args);
+    if (needed < 0) {
+        return;
+    }
+    outbuf_reserve(buf, (size_t)needed + 1);
+    va_start(args, fmt);
+    vsnprintf(buf->data + buf->len, (size_t)needed + 1, fmt, args);
+    va_end(args);
+    buf->len += (size_t)needed;
+}
+
+void outbuf_free(OutBuf *buf) {
+    free(buf->data);
+    buf->data = NULL;
+    buf->len = 0;
+    buf->cap = 0;
+}
+
+const char* cell_glyph(int cell, int emoji_mode) {
+    switch (cell) {
+        case CELL_BODY:
+            return emoji_mode ? EMOJI_SNAKE_BODY : "o";
+        case CELL_HEAD:
+            return emoji_mode ? EMOJI_SNAKE_HEAD : "@";
+        case CELL_FOOD:
+            return emoji_mode ? EMOJI_FOOD : "*";
+        default:
+            return emoji_mode ? "  " : " ";
+    }
+}
+
+void fill_cells(Game *game, Config* cfg, unsigned char* cells) {
+#ifdef BOARD_LAYOUT_TILED
+    for (int y = 0; y < cfg->board_height; y++) {
+        unsigned char* row = cells + (size_t)y * cfg->board_width;
+        for (int x = 0; x < cfg->board_width; x += BOARD_TILE_SIZE) {
+            int run = cfg->board_width - x < BOARD_TILE_SIZE ? cfg->board_width - x : BOARD_TILE_SIZE;
+            Point p = {x, y};
+            memcpy(row + x, game->grid + cell_index(cfg, p), run);
+        }
+    }
+#else
+    memcpy(cells, game->grid, (size_t)cfg->board_width * cfg->board_height);
+#endif
+    size_t food = (size_t)game->food.y * cfg->board_width + game->food.x;
+    if (cells[food] == CELL_EMPTY) {
+        cells[food] = CELL_FOOD;
+    }
+}
+
+int status_text(Game *game, char* buf, size_t size) {
+    if (game->paused) {
+        return snprintf(buf, size, "Score: %d - PAUSED (Press SPACE to resume)", game->score);
+    }
+    return snprintf(buf, size, "Score: %d", game->score);
+}
+
+int render_status(Game *game, OutBuf *out) {
+    char status[128];
+    int len = status_text(game, status, sizeof(status));
+    outbuf_write(out, status, (size_t)len);
+    return len;
+}
+
+static const char ascii_glyphs[16] = {' ', 'o', '@', '*', ' ', ' ', ' ', ' ',
+                                      ' ', ' ', ' ', ' ', ' ', ' ', ' ', ' '};
+
+static const struct {
+    char bytes[4];
+    int len;
+} emoji_glyphs[4] = {
+    [CELL_EMPTY] = {"  ", 2},
+    [CELL_BODY] = {EMOJI_SNAKE_BODY, sizeof(EMOJI_SNAKE_BODY) - 1},
+    [CELL_HEAD] = {EMOJI_SNAKE_HEAD, sizeof(EMOJI_SNAKE_HEAD) - 1},
+    [CELL_FOOD] = {EMOJI_FOOD, sizeof(EMOJI_FOOD) - 1}
+};
+
+static const unsigned char cell_rgb[SIXEL_COLORS][3] = {
+    [CELL_EMPTY] = {16, 16, 16},
+    [CELL_BODY] = {40, 170, 60},
+    [CELL_HEAD] = {150, 230, 90},
+    [CELL_FOOD] = {220, 40, 40},
+    [CELL_WALL] = {110, 110, 110}
+};
+
+typedef size_t (*RowComposer)(const unsigned char* cells, int count, char* out);
+
+size_t compose_row_scalar(const unsigned char* cells, int count, char* out) {
+    for (int i = 0; i < count; i++) {
+        out[i] = ascii_glyphs[cells[i] & 15];
+    }
+    return (size_t)count;
+}
+
+#if defined(__x86_64__) || defined(__i386__)
+__attribute__((target("ssse3")))
+size_t compose_row_ssse3(const unsigned char* cells, int count, char* out) {
+    __m128i table = _mm_loadu_si128((const __m128i*)ascii_glyphs);
+    __m128i mask = _mm_set1_epi8(15);
+    int i = 0;
+    for (; i + 16 <= count; i += 16) {
+        __m128i v = _mm_and_si128(_mm_loadu_si128((const __m128i*)(cells + i)), mask);
+        _mm_storeu_si128((__m128i*)(out + i), _mm_shuffle_epi8(table, v));
+    }
+    return i + compose_row_scalar(cells + i, count - i, out + i);
+}
+
+__attribute__((target("avx2")))
+size_t compose_row_avx2(const unsigned char* cells, int count, char* out) {
+    __m256i table = _mm256_broadcastsi128_si256(_mm_loadu_si128((const __m128i*)ascii_glyphs));
+    __m256i mask = _mm256_set1_epi8(15);
+    int i = 0;
+    for (; i + 32 <= count; i += 32) {
+        __m256i v = _mm256_and_si256(_mm256_loadu_si256((const __m256i*)(cells + i)), mask);
+        _mm256_storeu_si256((__m256i*)(out + i), _mm256_shuffle_epi8(table, v));
+    }
+    return i + compose_row_scalar(cells + i, count - i, out + i);
+}
+#endif
+
+RowComposer row_composer() {
+    static RowComposer composer;
+    if (!composer) {
+        RowComposer best = compose_row_scalar;
+#if defined(__x86_64__) || defined(__i386__)
+        __builtin_cpu_init();
+        if (__builtin_cpu_supports("avx2")) {
+            best = compose_row_avx2;
+        } else if (__builtin_cpu_supports("ssse3")) {
+            best = compose_row_ssse3;
+        }
+#endif
+        composer = best;
+    }
+    return composer;
+}
+
+size_t compose_row_emoji(const unsigned char* cells, int count, char* out) {
+    char* p = out;
+    for (int i = 0; i < count; i++) {
+        int cell = cells[i] & 3;
+        memcpy(p, emoji_glyphs[cell].bytes, 4);
+        p += emoji_glyphs[cell].len;
+    }
+    return (size_t)(p - out);
+}
+
+size_t row_bytes(Config* cfg, int width, const char* newline) {
+    size_t wall_len = cfg->emoji_mode ? strlen(EMOJI_WALL) : 1;
+    return 2 * wall_len + (size_t)width * 4 + strlen(newline);
+}
+
+void render_border(Config* cfg, int width, const char* newline, OutBuf *out) {
+    const char* wall = cfg->emoji_mode ? EMOJI_WALL : "#";
+    size_t wall_len = strlen(wall);
+    
+    outbuf_reserve(out, wall_len * (width + 2) + strlen(newline));
+    for (int x = -1; x <= width; x++) {
+        outbuf_write(out, wall, wall_len);
+    }
+    outbuf_puts(out, newline);
+}
+
+void render_row_range(Config* cfg, const unsigned char* cells, int width, int row_start, int row_end,
+                      const char* newline, OutBuf *out) {
+    const char* wall = cfg->emoji_mode ? EMOJI_WALL : "#";
+    size_t wall_len = strlen(wall);
+    size_t newline_len = strlen(newline);
+    RowComposer compose = cfg->emoji_mode ? compose_row_emoji : row_composer();
+    
+    outbuf_reserve(out, row_bytes(cfg, width, newline) * (row_end - row_start));
+    for (int y = row_start; y < row_end; y++) {
+        outbuf_write(out, wall, wall_len);
+        out->len += compose(cells + (size_t)y * width, width, out->data + out->len);
+        outbuf_write(out, wall, wall_len);
+        outbuf_write(out, newline, newline_len);
+    }
+}
+
+void render_rows(Config* cfg, const unsigned char* cells, int width, int height, const char* newline, OutBuf *out) {
+    render_border(cfg, width, newline, out);
+    render_row_range(cfg, cells, width, 0, height, newline, out);
+    render_border(cfg, width, newline, out);
+}
+
+int thread_count() {
+    int threads = worker_threads;
+    if (threads <= 0) {
+        threads = (int)sysconf(_SC_NPROCESSORS_ONLN);
+        if (threads <= 0) {
+            threads = 1;
+        }
+    }
+    return threads;
+}
+
+void* frame_band_worker(void* arg) {
+    FrameBand *band = (FrameBand*)arg;
+    FramePool *pool = band->pool;
+    
+    while (1) {
+        pthread_barrier_wait(&pool->start);
+        if (pool->stopping) {
+            break;
+        }
+        band->out.len = 0;
+        render_row_range(pool->cfg, pool->cells, pool->cfg->board_width, band->row_start, band->row_end,
+                         pool->newline, &band->out);
+        pthread_barrier_wait(&pool->done);
+    }
+    return NULL;
+}
+
+FramePool* frame_pool_start(Config* cfg) {
+    long long cells = (long long)cfg->board_width * cfg->board_height;
+    int band_count = thread_count();
+    if (band_count > cfg->board_height / FRAME_BAND_MIN_ROWS) {
+        band_count = cfg->board_height / FRAME_BAND_MIN_ROWS;
+    }
+    if (cells < FRAME_BAND_MIN_CELLS || band_count < 2 || cfg->render_profile == RENDER_SIXEL) {
+        return NULL;
+    }
+    
+    FramePool *pool = calloc(1, sizeof(FramePool));
+    pool->bands = calloc(band_count, sizeof(FrameBand));
+    pool->band_count = band_count;
+    pool->cfg = cfg;
+    pthread_barrier_init(&pool->start, NULL, band_count);
+    pthread_barrier_init(&pool->done, NULL, band_count);
+    for (int b = 0; b < band_count; b++) {
+        FrameBand *band = &pool->bands[b];
+        band->pool = pool;
+        band->row_start = (int)((long long)cfg->board_height * b / band_count);
+        band->row_end = (int)((long long)cfg->board_height * (b + 1) / band_count);
+        if (b > 0) {
+            outbuf_reserve(&band->out, row_bytes(cfg, cfg->board_width, "\r\n") * (band->row_end - band->row_start));
+            pthread_create(&band->thread, NULL, frame_band_worker, band);
+        }
+    }
+    return pool;
+}
+
+void frame_pool_stop(FramePool *pool) {
+    if (!pool) {
+        return;
+    }
+    pool->stopping = 1;
+    pthread_barrier_wait(&pool->start);
+    for (int b = 1; b < pool->band_count; b++) {
+        pthread_join(pool->bands[b].thread, NULL);
+        outbuf_free(&pool->bands[b].out);
+    }
+    pthread_barrier_destroy(&pool->start);
+    pthread_barrier_destroy(&pool->done);
+    outbuf_free(&pool->tail);
+    free(pool->bands);
+    free(pool);
+}
+
+void render_banded_rows(FramePool *pool, const unsigned char* cells, const char* newline, OutBuf *out) {
+    FrameBand *first = &pool->bands[0];
+    
+    pool->cells = cells;
+    pool->newline = newline;
+    pthread_barrier_wait(&pool->start);
+    render_row_range(pool->cfg, cells, pool->cfg->board_width, first->row_start, first->row_end, newline, out);
+    pthread_barrier_wait(&pool->done);
+    pool->tail.len = 0;
+    pool->pending = 1;
+}
+
+void render_full(Game *game, Config* cfg, const unsigned char* cells, const char* newline, OutBuf *out,
+                 FramePool *pool) {
+    outbuf_puts(out, "\033[H");
+    render_status(game, out);
+    outbuf_puts(out, newline);
+    outbuf_puts(out, newline);
+    
+    if (pool) {
+        render_border(cfg, cfg->board_width, newline, out);
+        render_banded_rows(pool, cells, newline, out);
+        out = &pool->tail;
+        render_border(cfg, cfg->board_width, newline, out);
+    } else {
+        render_rows(cfg, cells, cfg->board_width, cfg->board_height, newline, out);
+    }
+    
+    outbuf_puts(out, newline);
+    outbuf_puts(out, HELP_LINE);
+    outbuf_puts(out, newline);
+}
+
+int frame_segments(OutBuf *out, FramePool *pool, struct iovec *iov) {
+    int count = 0;
+    iov[count].iov_base = out->data;
+    iov[count++].iov_len = out->len;
+    if (pool && pool->pending) {
+        for (int b = 1; b < pool->band_count; b++) {
+            iov[count].iov_base = pool->bands[b].out.data;
+            iov[count++].iov_len = pool->bands[b].out.len;
+        }
+        iov[count].iov_base = pool->tail.data;
+        iov[count++].iov_len = pool->tail.len;
+    }
+    return count;
+}
+
+size_t frame_length(OutBuf *out, FramePool *pool) {
+    struct iovec iov[pool ? pool->band_count + 1 : 1];
+    int count = frame_segments(out, pool, iov);
+    size_t len = 0;
+    for (int i = 0; i < count; i++) {
+        len += iov[i].iov_len;
+    }
+    return len;
+}
+
+int frame_write(int fd, OutBuf *out, FramePool *pool) {
+    struct iovec iov[pool ? pool->band_count + 1 : 1];
+    int count = frame_segments(out, pool, iov);
+    int first = 0;
+    
+    while (first < count) {
+        ssize_t written = writev(fd, iov + first, count - first);
+        if (written < 0) {
+            if (errno == EINTR || errno == EAGAIN) {
+                continue;
+            }
+            return -1;
+        }
+        while (first < count && (size_t)written >= iov[first].iov_len) {
+            written -= iov[first].iov_len;
+            first++;
+        }
+        if (first < count) {
+            iov[first].iov_base = (char*)iov[first].iov_base + written;
+            iov[first].iov_len -= written;
+        }
+    }
+    return 0;
+}
+
+void sixel_cache_free(SixelCache *sixel) {
+    if (!sixel) {
+        return;
+    }
+    for (int b = 0; sixel->bands && b < sixel->band_count; b++) {
+        outbuf_free(&sixel->bands[b]);
+    }
+    outbuf_free(&sixel->header);
+    free(sixel->bands);
+    free(sixel->masks);
+    free(sixel->row_changed);
+    free(sixel->grid);
+    free(sixel);
+}
+
+SixelCache* sixel_cache_create(int width, int height, int cell_size) {
+    SixelCache *sixel = calloc(1, sizeof(SixelCache));
+    if (!sixel) {
+        return NULL;
+    }
+    sixel->cell_size = cell_size;
+    sixel->width = width + 2;
+    sixel->height = height + 2;
+    sixel->image_width = sixel->width * cell_size;
+    sixel->image_height = sixel->height * cell_size;
+    sixel->band_count = (sixel->image_height + SIXEL_BAND_ROWS - 1) / SIXEL_BAND_ROWS;
+    sixel->grid = malloc((size_t)sixel->width * sixel->height);
+    sixel->row_changed = malloc(sixel->height);
+    sixel->masks = malloc((size_t)SIXEL_COLORS * sixel->width);
+    sixel->bands = calloc(sixel->band_count, sizeof(OutBuf));
+    sixel->header.data = malloc(SIXEL_HEADER_SIZE);
+    sixel->header.cap = SIXEL_HEADER_SIZE;
+    if (!sixel->grid || !sixel->row_changed || !sixel->masks || !sixel->bands || !sixel->header.data) {
+        sixel_cache_free(sixel);
+        return NULL;
+    }
+    memset(sixel->grid, CELL_WALL, (size_t)sixel->width * sixel->height);
+    
+    outbuf_printf(&sixel->header, "\033P9;1q\"1;1;%d;%d", sixel->image_width, sixel->image_height);
+    for (int c = 0; c < SIXEL_COLORS; c++) {
+        outbuf_printf(&sixel->header, "#%d;2;%d;%d;%d", c, (cell_rgb[c][0] * 100 + 127) / 255,
+                      (cell_rgb[c][1] * 100 + 127) / 255, (cell_rgb[c][2] * 100 + 127) / 255);
+    }
+    return sixel;
+}
+
+int sixel_cell_size(int width) {
+    if (cell_size_given) {
+        return export_cell_size;
+    }
+    int size = SIXEL_DEFAULT_WIDTH / (width + 2);
+    return size < 1 ? 1 : size > export_cell_size ? export_cell_size : size;
+}
+
+int renderer_init_size(Renderer *r, Config* cfg, int width, int height) {
+    memset(r, 0, sizeof(*r));
+    r->width = width;
+    r->height = height;
+    r->cells = malloc((size_t)r->width * r->height);
+    r->newline = "\n";
+    r->profile = cfg->render_profile;
+    r->cursor_row = -1;
+    r->cursor_col = -1;
+    if (r->profile == RENDER_SIXEL) {
+        r->sixel = sixel_cache_create(width, height, sixel_cell_size(width));
+    }
+    if (!r->cells || (r->profile == RENDER_SIXEL && !r->sixel)) {
+        free(r->cells);
+        sixel_cache_free(r->sixel);
+        r->cells = NULL;
+        r->sixel = NULL;
+        return -1;
+    }
+    return 0;
+}
+
+int renderer_init(Renderer *r, Config* cfg) {
+    return renderer_init_size(r, cfg, cfg->board_width, cfg->board_height);
+}
+
+void renderer_free(Renderer *r) {
+    frame_pool_stop(r->bands);
+    r->bands = NULL;
+    sixel_cache_free(r->sixel);
+    r->sixel = NULL;
+    free(r->cells);
+    r->cells = NULL;
+}
+
+int count_digits(int n) {
+    int digits = 1;
+    while (n >= 10) {
+        n /= 10;
+        digits++;
+    }
+    return digits;
+}
+
+int horizontal_move(char* seq, int from, int to) {
+    char forward[16], restart[16];
+    int n = to > from ? to - from : from - to;
+    char code = to > from ? 'C' : 'D';
+    
+    if (n == 0) {
+        seq[0] = '\0';
+        return 0;
+    }
+    if (n == 1) {
+        snprintf(forward, sizeof(forward), "\033[%c", code);
+    } else {
+        snprintf(forward, sizeof(forward), "\033[%d%c", n, code);
+    }
+    if (to == 1) {
+        snprintf(restart, sizeof(restart), "\r");
+    } else if (to == 2) {
+        snprintf(restart, sizeof(restart), "\r\033[C");
+    } else {
+        snprintf(restart, sizeof(restart), "\r\033[%dC", to - 1);
+    }
+    strcpy(seq, strlen(restart) < strlen(forward) ? restart : forward);
+    return (int)strlen(seq);
+}
+
+int cursor_move(Renderer *r, char* seq, int row, int col) {
+    char best[32], candidate[32], horizontal[32];
+    
+    if (col == 1) {
+        snprintf(best, sizeof(best), row == 1 ? "\033[H" : "\033[%dH", row);
+    } else {
+        snprintf(best, sizeof(best), "\033[%d;%dH", row, col);
+    }
+    
+    if (r->cursor_row > 0) {
+        int rows = row - r->cursor_row;
+        if (rows == 0) {
+            horizontal_move(candidate, r->cursor_col, col);
+        } else {
+            int n = rows > 0 ? rows : -rows;
+            if (n == 1) {
+                snprintf(candidate, sizeof(candidate), "\033[%c", rows > 0 ? 'B' : 'A');
+            } else {
+                snprintf(candidate, sizeof(candidate), "\033[%d%c", n, rows > 0 ? 'B' : 'A');
+            }
+            horizontal_move(horizontal, r->cursor_col, col);
+            strcat(candidate, horizontal);
+        }
+        if (strlen(candidate) < strlen(best)) {
+            strcpy(best, candidate);
+        }
+        
+        if (rows > 0 && rows <= 3) {
+            candidate[0] = '\0';
+            for (int i = 0; i < rows; i++) {
+                strcat(candidate, "\r\n");
+            }
+            horizontal_move(horizontal, 1, col);
+            strcat(candidate, horizontal);
+            if (strlen(candidate) < strlen(best)) {
+                strcpy(best, candidate);
+            }
+        }
+    }
+    
+    strcpy(seq, best);
+    return (int)strlen(seq);
+}
+
+void render_changes(Renderer *r, Game *game, Config* cfg, const unsigned char* cells, OutBuf *out) {
+    int cell_width = cfg->emoji_mode ? 2 : 1;
+    char seq[32];
+    
+    if (game->score != r->score || game->paused != r->paused) {
+        outbuf_write(out, seq, cursor_move(r, seq, 1, 1));
+        int len = render_status(game, out);
+        if (len < r->status_len) {
+            outbuf_puts(out, "\033[K");
+        }
+        r->status_len = len;
+        r->cursor_row = 1;
+        r->cursor_col = len + 1;
+    }
+    
+    for (int y = 0; y < r->height; y++) {
+        int row = y + 4;
+        const unsigned char* line = cells + (size_t)y * r->width;
+        for (int x = 0; x < r->width; x++) {
+            size_t i = (size_t)y * r->width + x;
+            if (cells[i] == r->cells[i]) {
+                continue;
+            }
+            int col = (x + 1) * cell_width + 1;
+            
+            int move_len = cursor_move(r, seq, row, col);
+            int gap_x = (r->cursor_col - 1) / cell_width - 1;
+            if (r->cursor_row == row && r->cursor_col < col && gap_x >= 0 &&
+                (r->cursor_col - 1) % cell_width == 0) {
+                int overprint_len = 0;
+                for (int gx = gap_x; gx < x && overprint_len <= move_len; gx++) {
+                    overprint_len += (int)strlen(cell_glyph(line[gx], cfg->emoji_mode));
+                }
+                if (overprint_len <= move_len) {
+                    for (int gx = gap_x; gx < x; gx++) {
+                        outbuf_puts(out, cell_glyph(line[gx], cfg->emoji_mode));
+                    }
+                    move_len = -1;
+                }
+            }
+            if (move_len > 0) {
+                outbuf_write(out, seq, move_len);
+            }
+            
+            outbuf_puts(out, cell_glyph(cells[i], cfg->emoji_mode));
+            r->cursor_row = row;
+            r->cursor_col = col + cell_width;
+        }
+    }
+}
+
+int sixel_update_grid(SixelCache *sixel, const unsigned char* cells, int first) {
+    int width = sixel->width - 2;
+    int changed = first;
+    
+    memset(sixel->row_changed, first, sixel->height);
+    for (int y = 0; y < sixel->height - 2; y++) {
+        unsigned char* row = sixel->grid + (size_t)(y + 1) * sixel->width + 1;
+        const unsigned char* src = cells + (size_t)y * width;
+        if (memcmp(row, src, width) != 0) {
+            memcpy(row, src, width);
+            sixel->row_changed[y + 1] = 1;
+            changed = 1;
+        }
+    }
+    return changed;
+}
+
+int sixel_band_changed(SixelCache *sixel, int band) {
+    int first = band * SIXEL_BAND_ROWS / sixel->cell_size;
+    int last = ((band + 1) * SIXEL_BAND_ROWS - 1) / sixel->cell_size;
+    if (last >= sixel->height) {
+        last = sixel->height - 1;
+    }
+    for (int y = first; y <= last; y++) {
+        if (sixel->row_changed[y]) {
+            return 1;
+        }
+    }
+    return 0;
+}
+
+void sixel_put_run(OutBuf *out, char sixel, int count) {
+    if (count > 3) {
+        outbuf_printf(out, "!%d%c", count, sixel);
+        return;
+    }
+    outbuf_reserve(out, count);
+    memset(out->data + out->len, sixel, count);
+    out->len += count;
+}
+
+void sixel_encode_band(SixelCache *sixel, int band) {
+    OutBuf *out = &sixel->bands[band];
+    int width = sixel->width;
+    int present = 0;
+    
+    memset(sixel->masks, 0, (size_t)SIXEL_COLORS * width);
+    int py = band * SIXEL_BAND_ROWS;
+    int end = py + SIXEL_BAND_ROWS < sixel->image_height ? py + SIXEL_BAND_ROWS : sixel->image_height;
+    while (py < end) {
+        int y = py / sixel->cell_size;
+        int next = (y + 1) * sixel->cell_size < end ? (y + 1) * sixel->cell_size : end;
+        unsigned char bits = (unsigned char)(((1 << (next - py)) - 1) << (py - band * SIXEL_BAND_ROWS));
+        const unsigned char* row = sixel->grid + (size_t)y * width;
+        for (int x = 0; x < width; x++) {
+            sixel->masks[row[x] * width + x] |= bits;
+            present |= 1 << row[x];
+        }
+        py = next;
+    }
+    
+    out->len = 0;
+    int colors = 0;
+    for (int c = 0; c < SIXEL_COLORS; c++) {
+        if (!(present & (1 << c))) {
+            continue;
+        }
+        outbuf_printf(out, colors++ ? "$#%d" : "#%d", c);
+        const unsigned char* mask = sixel->masks + (size_t)c * width;
+        int x = 0;
+        while (x < width) {
+            int run = x + 1;
+            while (run < width && mask[run] == mask[x]) {
+                run++;
+            }
+            if (mask[x] == 0 && run == width) {
+                break;
+            }
+            sixel_put_run(out, (char)('?' + mask[x]), (run - x) * sixel->cell_size);
+            x = run;
+        }
+    }
+    if (band < sixel->band_count - 1) {
+        outbuf_puts(out, "-");
+    }
+    sixel->bands_encoded++;
+}
+
+void render_sixel(Renderer *r, Game *game, const unsigned char* cells, OutBuf *out) {
+    SixelCache *sixel = r->sixel;
+    
+    if (!r->has_frame) {
+        outbuf_puts(out, "\033[2J");
+    }
+    if (!r->has_frame || game->score != r->score || game->paused != r->paused) {
+        outbuf_puts(out, "\033[H");
+        render_status(game, out);
+        outbuf_puts(out, "\033[K");
+    }
+    if (sixel_update_grid(sixel, cells, !r->has_frame)) {
+        for (int b = 0; b < sixel->band_count; b++) {
+            if (sixel_band_changed(sixel, b)) {
+                sixel_encode_band(sixel, b);
+            }
+        }
+        outbuf_puts(out, "\033[3H");
+        outbuf_write(out, sixel->header.data, sixel->header.len);
+        for (int b = 0; b < sixel->band_count; b++) {
+            outbuf_write(out, sixel->bands[b].data, sixel->bands[b].len);
+        }
+        outbuf_puts(out, "\033\\");
+    }
+    if (!r->has_frame) {
+        outbuf_puts(out, r->newline);
+        outbuf_puts(out, HELP_LINE);
+        outbuf_puts(out, r->newline);
+    }
+}
+
+void render_frame(Renderer *r, Game *game, Config* cfg, const unsigned char* cells, OutBuf *out) {
+    size_t start = out->len;
+    
+    if (r->bands) {
+        r->bands->pending = 0;
+    }
+    if (r->sixel) {
+        render_sixel(r, game, cells, out);
+    } else if (!r->has_frame || r->profile == RENDER_FULL) {
+        char status[128];
+        if (!r->has_frame) {
+            outbuf_puts(out, "\033[2J");
+        }
+        render_full(game, cfg, cells, r->newline, out, r->bands);
+        r->status_len = status_text(game, status, sizeof(status));
+        r->cursor_row = cfg->board_height + 7;
+        r->cursor_col = 1;
+    } else {
+        render_changes(r, game, cfg, cells, out);
+    }
+    
+    memcpy(r->cells, cells, (size_t)r->width * r->height);
+    r->has_frame = 1;
+    r->score = game->score;
+    r->paused = game->paused;
+    r->frames++;
+    r->bytes += (long long)(frame_length(out, r->bands) - start);
+}
+
+void draw_board(Game *game, Config* cfg) {
+    static OutBuf frame;
+    static unsigned char* cells;
+    static size_t cells_size;
+    
+    size_t size = (size_t)cfg->board_width * cfg->board_height;
+    if (cells_size < size) {
+        cells = realloc(cells, size);
+        cells_size = size;
+    }
+    fill_cells(game, cfg, cells);
+    
+    frame.len = 0;
+    render_full(game, cfg, cells, "\n", &frame, NULL);
+    fwrite(frame.data, 1, frame.len, stdout);
+    fflush(stdout);
+}
+
+static const struct {
+    const char* name;
+    unsigned int type;
+    unsigned long long config;
+} perf_events[PERF_EVENT_COUNT] = {
+    [PERF_CYCLES] = {"cycles", PERF_TYPE_HARDWARE, PERF_COUNT_HW_CPU_CYCLES},
+    [PERF_INSTRUCTIONS] = {"instructions", PERF_TYPE_HARDWARE, PERF_COUNT_HW_INSTRUCTIONS},
+    [PERF_CACHE_MISSES] = {"cache-misses", PERF_TYPE_HARDWARE, PERF_COUNT_HW_CACHE_MISSES},
+    [PERF_BRANCH_MISSES] = {"branch-misses", PERF_TYPE_HARDWARE, PERF_COUNT_HW_BRANCH_MISSES}
+};
+
+static const char* perf_phase_names[PERF_PHASE_COUNT] = {"tick", "food", "render"};
+
+PerfCounters* active_perf = NULL;
+
+int perf_open(PerfCounters *perf) {
+    memset(perf, 0, sizeof(*perf));
+    for (int e = 0; e < PERF_EVENT_COUNT; e++) {
+        struct perf_event_attr attr;
+        memset(&attr, 0, sizeof(attr));
+        attr.size = sizeof(attr);
+        attr.type = perf_events[e].type;
+        attr.config = perf_events[e].config;
+        attr.disabled = (e == 0);
+        attr.exclude_kernel = 1;
+        attr.exclude_hv = 1;
+        attr.read_format = PERF_FORMAT_GROUP | PERF_FORMAT_ID | PERF_FORMAT_TOTAL_TIME_ENABLED |
+                           PERF_FORMAT_TOTAL_TIME_RUNNING;
+        perf->fds[e] = (int)syscall(SYS_perf_event_open, &attr, 0, -1, e == 0 ? -1 : perf->fds[0],
+                                    PERF_FLAG_FD_CLOEXEC);
+        if (perf->fds[e] < 0) {
+            if (e > 0) {
+                continue;
+            }
+            if (errno == ENOENT || errno == EOPNOTSUPP) {
+                printf("Error: This machine does not expose hardware performance counters\n");
+            } else {
+                printf("Error: Cannot open hardware performance counters: %s (see /proc/sys/kernel/perf_event_paranoid)\n",
+                       strerror(errno));
+            }
+            return -1;
+        }
+        ioctl(perf->fds[e], PERF_EVENT_IOC_ID, &perf->ids[e]);
+    }
+    ioctl(perf->fds[0], PERF_EVENT_IOC_ENABLE, PERF_IOC_FLAG_GROUP);
+    return 0;
+}
+
+void perf_close(PerfCounters *perf) {
+    if (!perf) {
+        return;
+    }
+    for (int e = PERF_EVENT_COUNT - 1; e >= 0; e--) {
+        if (perf->fds[e] >= 0) {
+            close(perf->fds[e]);
+        }
+    }
+}
+
+void perf_account(PerfCounters *perf) {
+    unsigned long long data[3 + 2 * PERF_EVENT_COUNT];
+    ssize_t got = read(perf->fds[0], data, sizeof(data));
+    if (got < (ssize_t)(3 * sizeof(data[0]))) {
+        return;
+    }
+    
+    unsigned long long now[PERF_EVENT_COUNT];
+    memcpy(now, perf->last, sizeof(now));
+    for (unsigned long long i = 0; i < data[0] && i < PERF_EVENT_COUNT; i++) {
+        for (int e = 0; e < PERF_EVENT_COUNT; e++) {
+            if (perf->fds[e] >= 0 && perf->ids[e] == data[4 + 2 * i]) {
+                now[e] = data[3 + 2 * i];
+            }
+        }
+    }
+    perf->time_enabled = data[1];
+    perf->time_running = data[2];
+    
+    if (perf->depth > 0) {
+        int phase = perf->stack[perf->depth - 1];
+        for (int e = 0; e < PERF_EVENT_COUNT; e++) {
+            perf->totals[phase][e] += now[e] - perf->last[e];
+        }
+    }
+    memcpy(perf->last, now, sizeof(now));
+}
+
+void perf_enter(PerfCounters *perf, int phase) {
+    if (!perf) {
+        return;
+    }
+    perf_account(perf);
+    perf->stack[perf->depth++] = phase;
+    perf->calls[phase]++;
+}
+
+void perf_leave(PerfCounters *perf) {
+    if (!perf) {
+        return;
+    }
+    perf_account(perf);
+    perf->depth--;
+}
+
+void perf_report(PerfCounters *perf) {
+    if (!perf) {
+        return;
+    }
+    printf("Performance counters (user space, mean per call, tick excludes food):\n");
+    printf("  %-8s %8s", "phase", "calls");
+    for (int e = 0; e < PERF_EVENT_COUNT; e++) {
+        printf(" %14s", perf_events[e].name);
+    }
+    printf(" %6s\n", "IPC");
+    for (int phase = 0; phase < PERF_PHASE_COUNT; phase++) {
+        long long calls = perf->calls[phase];
+        printf("  %-8s %8lld", perf_phase_names[phase], calls);
+        for (int e = 0; e < PERF_EVENT_COUNT; e++) {
+            if (perf->fds[e] < 0 || calls == 0) {
+                printf(" %14s", "n/a");
+            } else {
+                printf(" %14.1f", (double)perf->totals[phase][e] / calls);
+            }
+        }
+        if (perf->fds[PERF_INSTRUCTIONS] < 0 || perf->totals[phase][PERF_CYCLES] == 0) {
+            printf(" %6s\n", "n/a");
+        } else {
+            printf(" %6.2f\n", (double)perf->totals[phase][PERF_INSTRUCTIONS] / perf->totals[phase][PERF_CYCLES]);
+        }
+    }
+    if (perf->time_running < perf->time_enabled) {
+        printf("Counters were multiplexed and ran %.0f%% of the time; counts are not scaled\n",
+               100.0 * perf->time_running / perf->time_enabled);
+    }
+}
+
+void generate_food(Game *game, Config* cfg) {
+    long long total_cells = (long long)cfg->board_width * cfg->board_height;
+    
+    if (game->snake.length >= total_cells) {
+        game->game_over = 1;
+        return;
+    }
+    
+    int valid = 0;
+    long long attempts = 0;
+    while (!valid && attempts < total_cells * FOOD_PLACEMENT_MAX_ATTEMPTS_MULTIPLIER) {
+        game->food.x = game_rand(game) % cfg->board_width;
+        game->food.y = game_rand(game) % cfg->board_height;
+        
+        valid = game->grid[cell_index(cfg, game->food)] == CELL_EMPTY;
+        attempts++;
+    }
+    
+    if (!valid) {
+        game->game_over = 1;
+    }
+}
+
+void move_snake(Game *game, Config* cfg) {
+    Snake *snake = &game->snake;
+    Point head = snake_segment(snake, 0);
+    Point new_head = head;
+    
+    switch (snake->direction) {
+        case UP:
+            new_head.y--;
+            break;
+        case DOWN:
+            new_head.y++;
+            break;
+        case LEFT:
+            new_head.x--;
+            break;
+        case RIGHT:
+            new_head.x++;
+            break;
+    }
+    
+    if (cfg->wraparound_mode) {
+        if (new_head.x < 0) {
+            new_head.x = cfg->board_width - 1;
+        } else if (new_head.x >= cfg->board_width) {
+            new_head.x = 0;
+        }
+        
+        if (new_head.y < 0) {
+            new_head.y = cfg->board_height - 1;
+        } else if (new_head.y >= cfg->board_height) {
+            new_head.y = 0;
+        }
+    } else {
+        if (new_head.x < 0 || new_head.x >= cfg->board_width || 
+            new_head.y < 0 || new_head.y >= cfg->board_height) {
+            game->game_over = 1;
+            return;
+        }
+    }
+    
+    int ate_food = (new_head.x == game->food.x && new_head.y == game->food.y);
+    size_t cell = cell_index(cfg, new_head);
+    
+    if (game->grid[cell] == CELL_BODY) {
+        game->game_over = 1;
+        return;
+    }
+    
+    if (cfg->game_mode == MODE_GREEDY && snake->length >= snake->max_length) {
+        game->game_over = 1;
+        return;
+    }
+    
+    int grow = (cfg->game_mode == MODE_GREEDY) || ate_food;
+    if (!grow) {
+        Point tail = snake_segment(snake, snake->length - 1);
+        if (tail.x >= 0) {
+            game->grid[cell_index(cfg, tail)] = CELL_EMPTY;
+        }
+        snake_pop_tail(snake);
+    }
+    if (snake_push_head(snake, new_head) != 0) {
+        game->game_over = 1;
+        return;
+    }
+    game->grid[cell_index(cfg, head)] = CELL_BODY;
+    game->grid[cell] = CELL_HEAD;
+    
+    if (ate_food) {
+        game->score += POINTS_PER_FOOD;
+        perf_enter(active_perf, PERF_PHASE_FOOD);
+        generate_food(game, cfg);
+        perf_leave(active_perf);
+    }
+}
+
+int decode_key(KeyDecoder *decoder, unsigned char c) {
+    if (decoder->state == 1) {
+        decoder->state = (c == '[') ? 2 : 0;
+        if (decoder->state == 2) {
+            return 0;
+        }
+    } else if (decoder->state == 2) {
+        decoder->state = 0;
+        switch (c) {
+            case 'A':
+                return 'w';
+            case 'B':
+                return 's';
+            case 'C':
+                return 'd';
+            case 'D':
+                return 'a';
+        }
+        return 0;
+    }
+    
+    if (c == 27) {
+        decoder->state = 1;
+        return 0;
+    }
+    return c;
+}
+
+void apply_key(Game *game, int key) {
+    switch (key) {
+        case 'w':
+        case 'W':
+            if (game->snake.direction != DOWN) {
+                game->snake.direction = UP;
+            }
+            break;
+        case 's':
+        case 'S':
+            if (game->snake.direction != UP) {
+                game->snake.direction = DOWN;
+            }
+            break;
+        case 'a':
+        case 'A':
+            if (game->snake.direction != RIGHT) {
+                game->snake.direction = LEFT;
+            }
+            break;
+        case 'd':
+        case 'D':
+            if (game->snake.direction != LEFT) {
+                game->snake.direction = RIGHT;
+            }
+            break;
+        case 'q':
+        case 'Q':
             game->game_over = 1;
+            break;
+        case ' ':
+            game->paused = !game->paused;
+            break;
+    }
+}
+
+void command_queue_init(CommandQueue *queue) {
+    for (size_t i = 0; i < COMMAND_QUEUE_SIZE; i++) {
+        queue->slots[i].sequence = i;
+    }
+    queue->enqueue_pos = 0;
+    queue->dequeue_pos = 0;
+    queue->max_depth = 0;
+    queue->drops = 0;
+}
+
+int command_queue_push(CommandQueue *queue, int key, long long time_us) {
+    size_t pos = __atomic_load_n(&queue->enqueue_pos, __ATOMIC_RELAXED);
+    Command* slot;
+    
+    while (1) {
+        slot = &queue->slots[pos & (COMMAND_QUEUE_SIZE - 1)];
+        size_t sequence = __atomic_load_n(&slot->sequence, __ATOMIC_ACQUIRE);
+        long diff = (long)(sequence - pos);
+        if (diff == 0) {
+            if (__atomic_compare_exchange_n(&queue->enqueue_pos, &pos, pos + 1, 1, __ATOMIC_RELAXED, __ATOMIC_RELAXED)) {
+                break;
+            }
+        } else if (diff < 0) {
+            __atomic_fetch_add(&queue->drops, 1, __ATOMIC_RELAXED);
+            return -1;
+        } else {
+            pos = __atomic_load_n(&queue->enqueue_pos, __ATOMIC_RELAXED);
+        }
+    }
+    
+    slot->key = key;
+    slot->time_us = time_us;
+    __atomic_store_n(&slot->sequence, pos + 1, __ATOMIC_RELEASE);
+    
+    long depth = (long)(pos + 1 - __atomic_load_n(&queue->dequeue_pos, __ATOMIC_RELAXED));
+    if (depth > COMMAND_QUEUE_SIZE) {
+        depth = COMMAND_QUEUE_SIZE;
+    }
+    size_t max_depth = __atomic_load_n(&queue->max_depth, __ATOMIC_RELAXED);
+    while (depth > (long)max_depth &&
+           !__atomic_compare_exchange_n(&queue->max_depth, &max_depth, depth, 1, __ATOMIC_RELAXED, __ATOMIC_RELAXED)) {
+    }
+    return 0;
+}
+
+int command_queue_pop(CommandQueue *queue, Command *command) {
+    size_t pos = queue->dequeue_pos;
+    Command* slot = &queue->slots[pos & (COMMAND_QUEUE_SIZE - 1)];
+    if (__atomic_load_n(&slot->sequence, __ATOMIC_ACQUIRE) != pos + 1) {
+        return 0;
+    }
+    command->key = slot->key;
+    command->time_us = slot->time_us;
+    __atomic_store_n(&slot->sequence, pos + COMMAND_QUEUE_SIZE, __ATOMIC_RELEASE);
+    __atomic_store_n(&queue->dequeue_pos, pos + 1, __ATOMIC_RELAXED);
+    return 1;
+}
+
+int command_queue_apply(CommandQueue *queue, Game *game, long long now, long long *wait_us) {
+    Command command;
+    int applied = 0;
+    
+    while (!game->game_over && command_queue_pop(queue, &command)) {
+        int direction = game->snake.direction;
+        apply_key(game, command.key);
+        applied++;
+        *wait_us += now - command.time_us;
+        if (game->snake.direction != direction) {
+            break;
+        }
+    }
+    return applied;
+}
+
+void* key_reader_thread(void* arg) {
+    KeyReader *reader = arg;
+    KeyDecoder decoder = {0};
+    int tty = isatty(STDIN_FILENO);
+    unsigned char buf[64];
+    struct pollfd fds[2] = {{STDIN_FILENO, POLLIN, 0}, {reader->stop[0], POLLIN, 0}};
+    
+    while (1) {
+        if (poll(fds, 2, -1) < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            break;
+        }
+        if (fds[1].revents) {
+            break;
+        }
+        ssize_t n = read(STDIN_FILENO, buf, sizeof(buf));
+        if (n < 0 && errno == EINTR) {
+            continue;
+        }
+        if (n < 0 || (n == 0 && (!tty || (fds[0].revents & (POLLHUP | POLLERR))))) {
+            break;
+        }
+        
+        long long now = monotonic_us();
+        for (ssize_t i = 0; i < n; i++) {
+            int key = decode_key(&decoder, buf[i]);
+            if (key == ' ') {
+                __atomic_fetch_add(&reader->pauses, 1, __ATOMIC_RELAXED);
+            } else if (key == 'q' || key == 'Q') {
+                __atomic_store_n(&reader->quit, 1, __ATOMIC_RELAXED);
+            } else if (key && reader->steer && strchr(COMMAND_KEYS, key)) {
+                command_queue_push(reader->queue, key, now);
+            }
+        }
+        if (n > 0 && write(reader->wake[1], "", 1) < 0 && errno != EAGAIN) {
+            break;
+        }
+    }
+    return NULL;
+}
+
+int key_reader_start(KeyReader *reader, CommandQueue *queue, int steer) {
+    memset(reader, 0, sizeof(*reader));
+    reader->queue = queue;
+    reader->steer = steer;
+    if (pipe2(reader->stop, O_CLOEXEC) != 0) {
+        return -1;
+    }
+    if (pipe2(reader->wake, O_CLOEXEC | O_NONBLOCK) != 0) {
+        close(reader->stop[0]);
+        close(reader->stop[1]);
+        return -1;
+    }
+    if (pthread_create(&reader->thread, NULL, key_reader_thread, reader) != 0) {
+        close(reader->stop[0]);
+        close(reader->stop[1]);
+        close(reader->wake[0]);
+        close(reader->wake[1]);
+        return -1;
+    }
+    return 0;
+}
+
+int key_reader_poll(KeyReader *reader, Game *game) {
+    char buf[64];
+    while (read(reader->wake[0], buf, sizeof(buf)) > 0) {
+    }
+    
+    int pauses = __atomic_exchange_n(&reader->pauses, 0, __ATOMIC_RELAXED);
+    int quit = __atomic_exchange_n(&reader->quit, 0, __ATOMIC_RELAXED);
+    if (pauses & 1) {
+        game->paused = !game->paused;
+    }
+    if (quit) {
+        game->game_over = 1;
+    }
+    return pauses + quit;
+}
+
+void key_reader_stop(KeyReader *reader) {
+    close(reader->stop[1]);
+    pthread_join(reader->thread, NULL);
+    close(reader->stop[0]);
+    close(reader->wake[0]);
+    close(reader->wake[1]);
+}
+
+void put_u32(unsigned char* p, unsigned int v) {
+    for (int i = 0; i < 4; i++) {
+        p[i] = (unsigned char)(v >> (8 * i));
+    }
+}
+
+void put_u64(unsigned char* p, unsigned long long v) {
+    for (int i = 0; i < 8; i++) {
+        p[i] = (unsigned char)(v >> (8 * i));
+    }
+}
+
+unsigned int get_u32(const unsigned char* p) {
+    unsigned int v = 0;
+    for (int i = 0; i < 4; i++) {
+        v |= (unsigned int)p[i] << (8 * i);
+    }
+    return v;
+}
+
+unsigned long long get_u64(const unsigned char* p) {
+    unsigned long long v = 0;
+    for (int i = 0; i < 8; i++) {
+        v |= (unsigned long long)p[i] << (8 * i);
+    }
+    return v;
+}
+
+void keyframe_index_add(KeyframeIndex *index, long long tick, long long offset) {
+    if (index->count == index->cap) {
+        index->cap = index->cap ? index->cap * 2 : 64;
+        index->ticks = realloc(index->ticks, index->cap * sizeof(long long));
+        index->offsets = realloc(index->offsets, index->cap * sizeof(long long));
+    }
+    index->ticks[index->count] = tick;
+    index->offsets[index->count] = offset;
+    index->count++;
+}
+
+void keyframe_index_free(KeyframeIndex *index) {
+    free(index->ticks);
+    free(index->offsets);
+    memset(index, 0, sizeof(*index));
+}
+
+int segment_direction(Point from, Point to) {
+    int dx = to.x - from.x;
+    int dy = to.y - from.y;
+    if (dx == 1 || dx < -1) {
+        return RIGHT;
+    } else if (dx == -1 || dx > 1) {
+        return LEFT;
+    } else if (dy == 1 || dy < -1) {
+        return DOWN;
+    }
+    return UP;
+}
+
+Point step_point(Point p, int direction, Config* cfg) {
+    switch (direction) {
+        case UP:
+            p.y = (p.y == 0) ? cfg->board_height - 1 : p.y - 1;
+            break;
+        case DOWN:
+            p.y = (p.y == cfg->board_height - 1) ? 0 : p.y + 1;
+            break;
+        case LEFT:
+            p.x = (p.x == 0) ? cfg->board_width - 1 : p.x - 1;
+            break;
+        case RIGHT:
+            p.x = (p.x == cfg->board_width - 1) ? 0 : p.x + 1;
+            break;
+    }
+    return p;
+}
+
+int replay_writer_open(ReplayWriter *w, const char* path, Config* cfg, unsigned long long seed) {
+    memset(w, 0, sizeof(*w));
+    w->file = fopen(path, "wb");
+    if (!w->file) {
+        printf("Error: Cannot open '%s' for recording\n", path);
+        return 1;
+    }
+    w->path = path;
+    
+    unsigned char header[REPLAY_HEADER_SIZE] = {0};
+    memcpy(header, REPLAY_MAGIC, 4);
+    header[4] = REPLAY_VERSION;
+    header[5] = (unsigned char)cfg->wraparound_mode;
+    header[6] = (unsigned char)cfg->game_mode;
+    put_u32(header + 8, (unsigned int)cfg->board_width);
+    put_u32(header + 12, (unsigned int)cfg->board_height);
+    put_u32(header + 16, (unsigned int)cfg->move_fps);
+    put_u64(header + 24, seed);
+    fwrite(header, 1, sizeof(header), w->file);
+    return 0;
+}
+
+void replay_writer_keyframe(ReplayWriter *w, Game *game) {
+    Snake *snake = &game->snake;
+    Point head = snake_segment(snake, 0);
+    unsigned char fixed[KEYFRAME_FIXED_SIZE];
+    
+    put_u64(fixed, (unsigned long long)w->tick);
+    put_u64(fixed + 8, game->rng_state);
+    put_u32(fixed + 16, (unsigned int)game->score);
+    put_u32(fixed + 20, (unsigned int)game->food.x);
+    put_u32(fixed + 24, (unsigned int)game->food.y);
+    put_u32(fixed + 28, (unsigned int)snake->length);
+    put_u32(fixed + 32, (unsigned int)head.x);
+    put_u32(fixed + 36, (unsigned int)head.y);
+    fixed[40] = (unsigned char)snake->direction;
+    
+    keyframe_index_add(&w->index, w->tick, (long long)ftello(w->file));
+    fputc(REPLAY_TAG_KEYFRAME, w->file);
+    fwrite(fixed, 1, sizeof(fixed), w->file);
+    
+    unsigned char packed = 0;
+    Point prev = head;
+    for (long long i = 1; i < snake->length; i++) {
+        Point p = snake_segment(snake, i);
+        packed |= (unsigned char)((segment_direction(prev, p) - 1) << (2 * ((i - 1) % 4)));
+        if ((i - 1) % 4 == 3 || i == snake->length - 1) {
+            fputc(packed, w->file);
+            packed = 0;
+        }
+        prev = p;
+    }
+    w->last_keyframe_tick = w->tick;
+}
+
+unsigned long long game_state_hash(Game *game) {
+    Snake *snake = &game->snake;
+    unsigned long long h = game->rng_state;
+    unsigned long long words[3] = {
+        (unsigned long long)game->score,
+        ((unsigned long long)game->food.x << 32) | (unsigned int)game->food.y,
+        (unsigned long long)snake->length
+    };
+    
+    for (int i = 0; i < 3; i++) {
+        h = (h ^ words[i]) * 0x9E3779B97F4A7C15ULL;
+        h ^= h >> 29;
+    }
+    for (long long i = 0; i < snake->length; i++) {
+        Point p = snake_segment(snake, i);
+        h = (h ^ (((unsigned long long)p.x << 32) | (unsigned int)p.y)) * 0x9E3779B97F4A7C15ULL;
+        h ^= h >> 29;
+    }
+    return h;
+}
+
+void replay_writer_tick(ReplayWriter *w, Game *game) {
+    if (!w->file) {
+        return;
+    }
+    long long since = w->tick - w->last_keyframe_tick;
+    if (w->tick > 0 && since >= keyframe_interval &&
+        since * KEYFRAME_STREAM_RATIO >= KEYFRAME_FIXED_SIZE + game->snake.length / 4) {
+        replay_writer_keyframe(w, game);
+    }
+    if (w->tick % checksum_interval == 0) {
+        unsigned char hash[8];
+        put_u64(hash, game_state_hash(game));
+        fputc(REPLAY_TAG_CHECKSUM, w->file);
+        fwrite(hash, 1, sizeof(hash), w->file);
+    }
+    fputc(game->snake.direction, w->file);
+    w->tick++;
+}
+
+int replay_writer_close(ReplayWriter *w) {
+    if (!w->file) {
+        return 0;
+    }
+    
+    unsigned char buf[16];
+    long long index_offset = (long long)ftello(w->file);
+    fputc(REPLAY_TAG_INDEX, w->file);
+    put_u64(buf, (unsigned long long)w->tick);
+    put_u32(buf + 8, (unsigned int)w->index.count);
+    fwrite(buf, 1, 12, w->file);
+    for (int i = 0; i < w->index.count; i++) {
+        put_u64(buf, (unsigned long long)w->index.ticks[i]);
+        put_u64(buf + 8, (unsigned long long)w->index.offsets[i]);
+        fwrite(buf, 1, 16, w->file);
+    }
+    put_u64(buf, (unsigned long long)index_offset);
+    memcpy(buf + 8, REPLAY_INDEX_MAGIC, 4);
+    fwrite(buf, 1, REPLAY_TRAILER_SIZE, w->file);
+    
+    int failed = ferror(w->file);
+    failed |= fclose(w->file) != 0;
+    w->file = NULL;
+    keyframe_index_free(&w->index);
+    if (failed) {
+        printf("Error: Writing the replay to '%s' failed, the file is incomplete\n", w->path);
+    }
+    return failed;
+}
+
+void replay_reader_load_index(ReplayReader *r) {
+    unsigned char buf[16];
+    if (fseeko(r->file, -REPLAY_TRAILER_SIZE, SEEK_END) != 0) {
+        return;
+    }
+    long long trailer_offset = (long long)ftello(r->file);
+    if (fread(buf, 1, REPLAY_TRAILER_SIZE, r->file) != REPLAY_TRAILER_SIZE ||
+        memcmp(buf + 8, REPLAY_INDEX_MAGIC, 4) != 0) {
+        return;
+    }
+    
+    long long index_offset = (long long)get_u64(buf);
+    if (index_offset < REPLAY_HEADER_SIZE || index_offset >= trailer_offset ||
+        fseeko(r->file, index_offset, SEEK_SET) != 0 ||
+        fgetc(r->file) != REPLAY_TAG_INDEX ||
+        fread(buf, 1, 12, r->file) != 12) {
+        return;
+    }
+    long long total_ticks = (long long)get_u64(buf);
+    long long count = get_u32(buf + 8);
+    if (count * 16 > trailer_offset - index_offset) {
+        return;
+    }
+    
+    for (long long i = 0; i < count; i++) {
+        if (fread(buf, 1, 16, r->file) != 16) {
+            keyframe_index_free(&r->index);
+            return;
+        }
+        keyframe_index_add(&r->index, (long long)get_u64(buf), (long long)get_u64(buf + 8));
+    }
+    r->total_ticks = total_ticks;
+}
+
+int replay_reader_open(ReplayReader *r, const char* path) {
+    memset(r, 0, sizeof(*r));
+    r->total_ticks = -1;
+    r->diverged_tick = -1;
+    r->file = fopen(path, "rb");
+    if (!r->file) {
+        printf("Error: Cannot open replay '%s'\n", path);
+        return 1;
+    }
+    
+    unsigned char header[REPLAY_HEADER_SIZE];
+    if (fread(header, 1, sizeof(header), r->file) != sizeof(header) ||
+        memcmp(header, REPLAY_MAGIC, 4) != 0) {
+        printf("Error: '%s' is not a snake replay\n", path);
+        fclose(r->file);
+        return 1;
+    }
+    if (header[4] < 1 || header[4] > REPLAY_VERSION) {
+        printf("Error: Unsupported replay version %d\n", header[4]);
+        fclose(r->file);
+        return 1;
+    }
+    
+    r->wraparound_mode = header[5];
+    r->game_mode = header[6] == MODE_GREEDY ? MODE_GREEDY : MODE_REGULAR;
+    r->board_width = (int)get_u32(header + 8);
+    r->board_height = (int)get_u32(header + 12);
+    r->move_fps = (int)get_u32(header + 16);
+    r->seed = get_u64(header + 24);
+    if (r->board_width <= 0 || r->board_height <= 0 || r->move_fps <= 0) {
+        printf("Error: Replay '%s' has an invalid header\n", path);
+        fclose(r->file);
+        return 1;
+    }
+    
+    if (header[4] >= 2) {
+        replay_reader_load_index(r);
+    }
+    fseeko(r->file, REPLAY_HEADER_SIZE, SEEK_SET);
+    return 0;
+}
+
+void replay_reader_apply(ReplayReader *r, Config* cfg) {
+    cfg->board_width = r->board_width;
+    cfg->board_height = r->board_height;
+    cfg->move_fps = r->move_fps;
+    cfg->wraparound_mode = r->wraparound_mode;
+    cfg->game_mode = r->game_mode;
+    calculate_intervals(cfg);
+}
+
+int replay_reader_next(ReplayReader *r, Game *game) {
+    while (1) {
+        int c = getc_unlocked(r->file);
+        if (c >= UP && c <= RIGHT) {
+            r->tick++;
+            return c;
+        }
+        if (c == REPLAY_TAG_CHECKSUM) {
+            unsigned char hash[8];
+            if (fread(hash, 1, sizeof(hash), r->file) != sizeof(hash)) {
+                return 0;
+            }
+            if (get_u64(hash) == game_state_hash(game)) {
+                r->checksums++;
+            } else if (r->diverged_tick < 0) {
+                r->diverged_tick = r->tick;
+            }
+            continue;
+        }
+        if (c != REPLAY_TAG_KEYFRAME) {
+            return 0;
+        }
+        
+        unsigned char fixed[KEYFRAME_FIXED_SIZE];
+        if (fread(fixed, 1, sizeof(fixed), r->file) != sizeof(fixed)) {
+            return 0;
+        }
+        long long length = get_u32(fixed + 28);
+        fseeko(r->file, (length + 2) / 4, SEEK_CUR);
+    }
+}
+
+int replay_reader_restore(ReplayReader *r, Game *game, Config* cfg) {
+    unsigned char fixed[KEYFRAME_FIXED_SIZE];
+    if (fgetc(r->file) != REPLAY_TAG_KEYFRAME ||
+        fread(fixed, 1, sizeof(fixed), r->file) != sizeof(fixed)) {
+        return 1;
+    }
+    
+    Snake *snake = &game->snake;
+    long long length = get_u32(fixed + 28);
+    Point head = {(int)get_u32(fixed + 32), (int)get_u32(fixed + 36)};
+    Point food = {(int)get_u32(fixed + 20), (int)get_u32(fixed + 24)};
+    if (length < 1 || length > snake->max_length ||
+        head.x < 0 || head.x >= cfg->board_width || head.y < 0 || head.y >= cfg->board_height ||
+        food.x < 0 || food.x >= cfg->board_width || food.y < 0 || food.y >= cfg->board_height) {
+        return 1;
+    }
+    
+    clear_snake_cells(game, cfg);
+    snake_clear(snake);
+    snake->direction = fixed[40];
+    Point* slot = snake_slot(snake, 0);
+    if (!slot) {
+        return 1;
+    }
+    *slot = head;
+    snake->length = 1;
+    game->grid[cell_index(cfg, head)] = CELL_HEAD;
+    
+    Point p = head;
+    int packed = 0;
+    for (long long i = 1; i < length; i++) {
+        if ((i - 1) % 4 == 0) {
+            packed = getc_unlocked(r->file);
+            if (packed == EOF) {
+                return 1;
+            }
+        }
+        p = step_point(p, ((packed >> (2 * ((i - 1) % 4))) & 3) + 1, cfg);
+        size_t cell = cell_index(cfg, p);
+        slot = game->grid[cell] == CELL_EMPTY ? snake_slot(snake, i) : NULL;
+        if (!slot) {
+            return 1;
+        }
+        *slot = p;
+        game->grid[cell] = CELL_BODY;
+        snake->length = i + 1;
+    }
+    
+    r->tick = (long long)get_u64(fixed);
+    game->rng_state = get_u64(fixed + 8);
+    game->score = (int)get_u32(fixed + 16);
+    game->food = food;
+    game->game_over = 0;
+    return 0;
+}
+
+int replay_reader_rewind(ReplayReader *r, Game *game, Config* cfg) {
+    int paused = game->paused;
+    cleanup_game(game);
+    if (init_game(game, cfg, r->seed) != 0) {
+        return -1;
+    }
+    game->paused = paused;
+    fseeko(r->file, REPLAY_HEADER_SIZE, SEEK_SET);
+    r->tick = 0;
+    return 0;
+}
+
+int replay_seek(ReplayReader *r, Game *game, Config* cfg, long long target) {
+    if (target < 0) {
+        target = 0;
+    }
+    
+    int lo = 0, hi = r->index.count - 1, found = -1;
+    while (lo <= hi) {
+        int mid = (lo + hi) / 2;
+        if (r->index.ticks[mid] <= target) {
+            found = mid;
+            lo = mid + 1;
+        } else {
+            hi = mid - 1;
+        }
+    }
+    
+    int use_keyframe = found >= 0 && (target < r->tick || r->index.ticks[found] > r->tick);
+    if (use_keyframe) {
+        fseeko(r->file, r->index.offsets[found], SEEK_SET);
+        if (replay_reader_restore(r, game, cfg) != 0 && replay_reader_rewind(r, game, cfg) != 0) {
+            return -1;
+        }
+    } else if (target < r->tick && replay_reader_rewind(r, game, cfg) != 0) {
+        return -1;
+    }
+    
+    while (r->tick < target && !game->game_over) {
+        int direction = replay_reader_next(r, game);
+        if (!direction) {
+            return 1;
+        }
+        game->snake.direction = direction;
+        move_snake(game, cfg);
+    }
+    return 0;
+}
+
+int replay_reader_report(ReplayReader *r) {
+    if (r->diverged_tick >= 0) {
+        printf("Replay diverged from the recording at tick %lld (%lld state checksums matched)\n",
+               r->diverged_tick, r->checksums);
+        return 1;
+    }
+    if (r->checksums > 0) {
+        printf("Verified %lld state checksums\n", r->checksums);
+    }
+    return 0;
+}
+
+void replay_reader_close(ReplayReader *r) {
+    if (r->file) {
+        fclose(r->file);
+        r->file = NULL;
+    }
+    keyframe_index_free(&r->index);
+}
+
+int rerecord_replay(ReplayReader *replay, Config* cfg, const char* path) {
+    Game game;
+    if (init_game(&game, cfg, replay->seed) != 0) {
+        printf("Error: Not enough memory for a %dx%d board\n", cfg->board_width, cfg->board_height);
+        return 1;
+    }
+    
+    ReplayWriter writer;
+    if (replay_writer_open(&writer, path, cfg, replay->seed) != 0) {
+        cleanup_game(&game);
+        return 1;
+    }
+    
+    while (!game.game_over) {
+        int direction = replay_reader_next(replay, &game);
+        if (!direction) {
+            break;
+        }
+        game.snake.direction = direction;
+        replay_writer_tick(&writer, &game);
+        move_snake(&game, cfg);
+    }
+    
+    long long ticks = writer.tick;
+    int keyframes = writer.index.count;
+    int failed = replay_writer_close(&writer);
+    if (!failed) {
+        printf("Recorded %lld ticks with %d keyframes, final score %d\n", ticks, keyframes, game.score);
+    }
+    cleanup_game(&game);
+    return failed;
+}
+
+void cast_write_event(FILE* out, long long time_us, const struct iovec* iov, int count) {
+    fprintf(out, "[%lld.%06lld, \"o\", \"", time_us / MICROSECONDS_PER_SECOND, time_us % MICROSECONDS_PER_SECOND);
+    for (int s = 0; s < count; s++) {
+        const unsigned char* data = iov[s].iov_base;
+        for (size_t i = 0; i < iov[s].iov_len; i++) {
+            unsigned char c = data[i];
+            if (c == '"' || c == '\\') {
+                fputc('\\', out);
+                fputc(c, out);
+            } else if (c == '\n') {
+                fputs("\\n", out);
+            } else if (c == '\r') {
+                fputs("\\r", out);
+            } else if (c < 0x20) {
+                fprintf(out, "\\u%04x", c);
+            } else {
+                fputc(c, out);
+            }
+        }
+    }
+    fputs("\"]\n", out);
+}
+
+int export_cast(ReplayReader *replay, Config* cfg, const char* path) {
+    FILE* out = fopen(path, "w");
+    if (!out) {
+        printf("Error: Cannot open '%s' for writing\n", path);
+        return 1;
+    }
+    
+    int cell_width = cfg->emoji_mode ? 2 : 1;
+    int cols = (cfg->board_width + 2) * cell_width;
+    if (cols < (int)strlen(HELP_LINE)) {
+        cols = (int)strlen(HELP_LINE);
+    }
+    fprintf(out, "{\"version\": 2, \"width\": %d, \"height\": %d, \"timestamp\": %lld, "
+            "\"env\": {\"TERM\": \"xterm-256color\"}}\n",
+            cols, cfg->board_height + 7, (long long)time(NULL));
+    
+    Game game;
+    Renderer renderer;
+    if (init_game(&game, cfg, replay->seed) != 0 || renderer_init(&renderer, cfg) != 0) {
+        printf("Error: Not enough memory for a %dx%d board\n", cfg->board_width, cfg->board_height);
+        cleanup_game(&game);
+        fclose(out);
+        return 1;
+    }
+    renderer.newline = "\r\n";
+    renderer.profile = RENDER_BANDWIDTH;
+    renderer.bands = frame_pool_start(cfg);
+    unsigned char* cells = malloc((size_t)cfg->board_width * cfg->board_height);
+    OutBuf frame = {0};
+    struct iovec iov[renderer.bands ? renderer.bands->band_count + 1 : 1];
+    long long time_us = 0;
+    
+    outbuf_puts(&frame, "\033[?25l");
+    while (1) {
+        fill_cells(&game, cfg, cells);
+        render_frame(&renderer, &game, cfg, cells, &frame);
+        if (frame_length(&frame, renderer.bands) > 0) {
+            cast_write_event(out, time_us, iov, frame_segments(&frame, renderer.bands, iov));
+        }
+        frame.len = 0;
+        
+        if (game.game_over) {
+            break;
+        }
+        int direction = replay_reader_next(replay, &game);
+        if (!direction) {
+            break;
+        }
+        game.snake.direction = direction;
+        move_snake(&game, cfg);
+        time_us += cfg->move_interval;
+    }
+    
+    outbuf_printf(&frame, "\033[2J\033[HGame Over! Final Score: %d\r\n\033[?25h", game.score);
+    cast_write_event(out, time_us, iov, frame_segments(&frame, NULL, iov));
+    
+    outbuf_free(&frame);
+    free(cells);
+    renderer_free(&renderer);
+    cleanup_game(&game);
+    
+    int failed = ferror(out);
+    if (fclose(out) != 0 || failed) {
+        printf("Error: Failed writing '%s'\n", path);
+        return 1;
+    }
+    return 0;
+}
+
+int allowed_cpus(int* cpus) {
+    int count = 0;
+    cpu_set_t allowed;
+    if (sched_getaffinity(0, sizeof(allowed), &allowed) == 0) {
+        for (int cpu = 0; cpu < CPU_SETSIZE; cpu++) {
+            if (CPU_ISSET(cpu, &allowed)) {
+                cpus[count++] = cpu;
+            }
+        }
+    }
+    return count;
+}
+
+void pin_thread(int cpu) {
+    if (cpu >= 0) {
+        cpu_set_t set;
+        CPU_ZERO(&set);
+        CPU_SET(cpu, &set);
+        pthread_setaffinity_np(pthread_self(), sizeof(set), &set);
+    }
+}
+
+void image_export_palette(ImageExport *ex) {
+    for (int i = 0; i < 5; i++) {
+        int r = cell_rgb[i][0], g = cell_rgb[i][1], b = cell_rgb[i][2];
+        if (ex->format == EXPORT_Y4M) {
+            ex->palette[i][0] = (unsigned char)((77 * r + 150 * g + 29 * b + 128) >> 8);
+            ex->palette[i][1] = (unsigned char)((-43 * r - 85 * g + 128 * b + 128 * 256 + 128) >> 8);
+            ex->palette[i][2] = (unsigned char)((128 * r - 107 * g - 21 * b + 128 * 256 + 128) >> 8);
+        } else {
+            memcpy(ex->palette[i], cell_rgb[i], 3);
+        }
+    }
+}
+
+void rasterize_frame(ImageExport *ex, const unsigned char* cells, unsigned char* pixels) {
+    int w = ex->cfg->board_width;
+    int h = ex->cfg->board_height;
+    int cs = ex->cell_size;
+    size_t iw = (size_t)ex->image_width;
+    size_t plane = iw * ex->image_height;
+    
+    for (int cy = 0; cy < h + 2; cy++) {
+        for (int cx = 0; cx < w + 2; cx++) {
+            int cell = CELL_WALL;
+            if (cx > 0 && cx <= w && cy > 0 && cy <= h) {
+                cell = cells[(size_t)(cy - 1) * w + (cx - 1)];
+            }
+            const unsigned char* color = ex->palette[cell];
+            size_t first = (size_t)cy * cs * iw + (size_t)cx * cs;
+            if (ex->format == EXPORT_Y4M) {
+                for (int c = 0; c < 3; c++) {
+                    memset(pixels + c * plane + first, color[c], cs);
+                }
+            } else {
+                unsigned char* px = pixels + first * 3;
+                for (int i = 0; i < cs; i++) {
+                    memcpy(px + i * 3, color, 3);
+                }
+            }
+        }
+        
+        for (int c = 0; c < (ex->format == EXPORT_Y4M ? 3 : 1); c++) {
+            size_t row_bytes = ex->format == EXPORT_Y4M ? iw : iw * 3;
+            unsigned char* row = pixels + c * plane + (size_t)cy * cs * row_bytes;
+            for (int i = 1; i < cs; i++) {
+                memcpy(row + i * row_bytes, row, row_bytes);
+            }
+        }
+    }
+}
+
+void* image_export_worker(void* arg) {
+    ImageExport *ex = arg;
+    
+    pthread_mutex_lock(&ex->lock);
+    while (1) {
+        ExportSlot* slot = &ex->slots[ex->next_claim % ex->slot_count];
+        if (slot->state == SLOT_READY && slot->frame == ex->next_claim) {
+            slot->state = SLOT_BUSY;
+            ex->next_claim++;
+            pthread_mutex_unlock(&ex->lock);
+            
+            rasterize_frame(ex, slot->cells, slot->pixels);
+            
+            pthread_mutex_lock(&ex->lock);
+            slot->state = SLOT_DONE;
+            pthread_cond_broadcast(&ex->changed);
+            continue;
+        }
+        if (ex->done) {
+            break;
+        }
+        pthread_cond_wait(&ex->changed, &ex->lock);
+    }
+    pthread_mutex_unlock(&ex->lock);
+    return NULL;
+}
+
+void image_export_write(ImageExport *ex, ExportSlot* slot) {
+    if (ex->format == EXPORT_Y4M) {
+        fputs("FRAME\n", ex->stream);
+        if (fwrite(slot->pixels, 1, ex->frame_bytes, ex->stream) != ex->frame_bytes) {
+            ex->write_failed = 1;
+        }
+        return;
+    }
+    
+    char path[4096];
+    snprintf(path, sizeof(path), "%s/frame_%06lld.ppm", export_ppm_dir, slot->frame);
+    FILE* out = fopen(path, "wb");
+    if (!out) {
+        ex->write_failed = 1;
+        return;
+    }
+    fprintf(out, "P6\n%d %d\n255\n", ex->image_width, ex->image_height);
+    if (fwrite(slot->pixels, 1, ex->frame_bytes, out) != ex->frame_bytes) {
+        ex->write_failed = 1;
+    }
+    if (fclose(out) != 0) {
+        ex->write_failed = 1;
+    }
+}
+
+void image_export_retire(ImageExport *ex, ExportSlot* slot) {
+    pthread_mutex_lock(&ex->lock);
+    while (slot->state == SLOT_READY || slot->state == SLOT_BUSY) {
+        pthread_cond_wait(&ex->changed, &ex->lock);
+    }
+    pthread_mutex_unlock(&ex->lock);
+    
+    if (slot->state == SLOT_DONE) {
+        image_export_write(ex, slot);
+        slot->state = SLOT_FREE;
+    }
+}
+
+void image_export_free(ImageExport *ex) {
+    if (ex->stream && fclose(ex->stream) != 0) {
+        ex->write_failed = 1;
+    }
+    ex->stream = NULL;
+    for (int i = 0; ex->slots && i < ex->slot_count; i++) {
+        free(ex->slots[i].cells);
+        free(ex->slots[i].pixels);
+    }
+    free(ex->slots);
+    ex->slots = NULL;
+}
+
+int export_images(ReplayReader *replay, Config* cfg) {
+    Game game;
+    if (init_game(&game, cfg, replay->seed) != 0) {
+        printf("Error: Not enough memory for a %dx%d board\n", cfg->board_width, cfg->board_height);
+        return 1;
+    }
+    
+    ImageExport ex = {0};
+    ex.cfg = cfg;
+    ex.format = export_y4m_path ? EXPORT_Y4M : EXPORT_PPM;
+    ex.cell_size = export_cell_size;
+    ex.image_width = (cfg->board_width + 2) * ex.cell_size;
+    ex.image_height = (cfg->board_height + 2) * ex.cell_size;
+    ex.frame_bytes = (size_t)ex.image_width * ex.image_height * 3;
+    image_export_palette(&ex);
+    
+    if (ex.format == EXPORT_Y4M) {
+        ex.stream = fopen(export_y4m_path, "wb");
+        if (!ex.stream) {
+            printf("Error: Cannot open '%s' for writing\n", export_y4m_path);
+            cleanup_game(&game);
+            return 1;
+        }
+        fprintf(ex.stream, "YUV4MPEG2 W%d H%d F%d:1 Ip A1:1 C444\n",
+                ex.image_width, ex.image_height, cfg->move_fps);
+    }
+    
+    int threads = thread_count();
+    
+    ex.slot_count = threads * EXPORT_SLOTS_PER_THREAD;
+    ex.slots = calloc(ex.slot_count, sizeof(ExportSlot));
+    pthread_t* workers = malloc(threads * sizeof(pthread_t));
+    int failed = !ex.slots || !workers;
+    size_t cell_count = (size_t)cfg->board_width * cfg->board_height;
+    for (int i = 0; !failed && i < ex.slot_count; i++) {
+        ex.slots[i].cells = malloc(cell_count);
+        ex.slots[i].pixels = malloc(ex.frame_bytes);
+        failed = !ex.slots[i].cells || !ex.slots[i].pixels;
+    }
+    if (failed) {
+        printf("Error: Not enough memory for %d frame buffers of %zu bytes\n",
+               ex.slot_count, ex.frame_bytes);
+        image_export_free(&ex);
+        free(workers);
+        cleanup_game(&game);
+        return 1;
+    }
+    pthread_mutex_init(&ex.lock, NULL);
+    pthread_cond_init(&ex.changed, NULL);
+    
+    int started = 0;
+    while (started < threads && pthread_create(&workers[started], NULL, image_export_worker, &ex) == 0) {
+        started++;
+    }
+    if (started == 0) {
+        printf("Error: Cannot start export threads\n");
+        image_export_free(&ex);
+        free(workers);
+        pthread_mutex_destroy(&ex.lock);
+        pthread_cond_destroy(&ex.changed);
+        cleanup_game(&game);
+        return 1;
+    }
+    
+    long long frame = 0;
+    
+    while (1) {
+        ExportSlot* slot = &ex.slots[frame % ex.slot_count];
+        image_export_retire(&ex, slot);
+        fill_cells(&game, cfg, slot->cells);
+        
+        pthread_mutex_lock(&ex.lock);
+        slot->frame = frame;
+        slot->state = SLOT_READY;
+        pthread_cond_broadcast(&ex.changed);
+        pthread_mutex_unlock(&ex.lock);
+        frame++;
+        
+        if (game.game_over) {
+            break;
+        }
+        int direction = replay_reader_next(replay, &game);
+        if (!direction) {
+            break;
+        }
+        game.snake.direction = direction;
+        move_snake(&game, cfg);
+    }
+    
+    for (long long f = frame - ex.slot_count; f < frame; f++) {
+        if (f >= 0) {
+            image_export_retire(&ex, &ex.slots[f % ex.slot_count]);
+        }
+    }
+    
+    pthread_mutex_lock(&ex.lock);
+    ex.done = 1;
+    pthread_cond_broadcast(&ex.changed);
+    pthread_mutex_unlock(&ex.lock);
+    for (int i = 0; i < started; i++) {
+        pthread_join(workers[i], NULL);
+    }
+    
+    image_export_free(&ex);
+    free(workers);
+    pthread_mutex_destroy(&ex.lock);
+    pthread_cond_destroy(&ex.changed);
+    cleanup_game(&game);
+    
+    if (ex.write_failed) {
+        printf("Error: Failed writing exported frames\n");
+        return 1;
+    }
+    printf("Exported %lld frames (%dx%d pixels)\n", frame, ex.image_width, ex.image_height);
+    return 0;
+}
+
+int read_replay_key() {
+    if (!kbhit()) {
+        return 0;
+    }
+    int c = getchar();
+    if (c == 27 && kbhit() && getchar() == '[' && kbhit()) {
+        switch (getchar()) {
+            case 'C':
+                return ']';
+            case 'D':
+                return '[';
+        }
+        return 0;
+    }
+    return c;
+}
+
+int play_replay(ReplayReader *replay, Config* cfg) {
+    Game game;
+    if (init_game(&game, cfg, replay->seed) != 0) {
+        printf("Error: Not enough memory for a %dx%d board\n", cfg->board_width, cfg->board_height);
+        return 1;
+    }
+    
+    enable_raw_mode();
+    hide_cursor();
+    clear_screen();
+    
+    int ended = replay_seek(replay, &game, cfg, replay_start_tick);
+    int quit = ended < 0;
+    long long seek_step = (long long)cfg->move_fps * REPLAY_SEEK_SECONDS;
+    
+    struct timespec start_time, current_time;
+    clock_gettime(CLOCK_MONOTONIC, &start_time);
+    long long last_render = -cfg->render_interval;
+    long long last_move = 0;
+    long long idle_us = 0;
+    
+    while (!quit) {
+        clock_gettime(CLOCK_MONOTONIC, &current_time);
+        long long elapsed_us = (current_time.tv_sec - start_time.tv_sec) * 1000000LL + 
+                              (current_time.tv_nsec - start_time.tv_nsec) / 1000LL - idle_us;
+        
+        int key = read_replay_key();
+        int seek = 1;
+        long long target = replay->tick;
+        switch (key) {
+            case 'q':
+            case 'Q':
+                quit = 1;
+                seek = 0;
+                break;
+            case ' ':
+                game.paused = !game.paused;
+                seek = 0;
+                break;
+            case '.':
+                target++;
+                game.paused = 1;
+                break;
+            case ',':
+                target--;
+                game.paused = 1;
+                break;
+            case ']':
+                target += seek_step;
+                break;
+            case '[':
+                target -= seek_step;
+                break;
+            default:
+                if (key >= '0' && key <= '9' && replay->total_ticks > 0) {
+                    target = replay->total_ticks * (key - '0') / 10;
+                } else {
+                    seek = 0;
+                }
+                break;
+        }
+        if (seek) {
+            ended = replay_seek(replay, &game, cfg, target);
+            if (ended < 0) {
+                break;
+            }
+            last_move = elapsed_us;
+            last_render = -cfg->render_interval;
+        }
+        
+        if (elapsed_us - last_move >= cfg->move_interval && !game.paused && !ended && !game.game_over) {
+            int direction = replay_reader_next(replay, &game);
+            if (direction) {
+                game.snake.direction = direction;
+                perf_enter(active_perf, PERF_PHASE_TICK);
+                move_snake(&game, cfg);
+                perf_leave(active_perf);
+            } else {
+                ended = 1;
+            }
+            last_move = elapsed_us;
+        }
+        
+        int idle = game.paused || ended || game.game_over;
+        if (idle || elapsed_us - last_render >= cfg->render_interval) {
+            perf_enter(active_perf, PERF_PHASE_RENDER);
+            draw_board(&game, cfg);
+            perf_leave(active_perf);
+            if (replay->total_ticks >= 0) {
+                printf("Replay tick %lld/%lld", replay->tick, replay->total_ticks);
+            } else {
+                printf("Replay tick %lld", replay->tick);
+            }
+            printf("%s - ,/. step, [/] seek %ds, 0-9 jump\033[K", (ended || game.game_over) ? " (end)" : "",
+                   REPLAY_SEEK_SECONDS);
+            fflush(stdout);
+            last_render = elapsed_us;
+        }
+        
+        if (idle && !quit) {
+            idle_us += wait_for_input(STDIN_FILENO);
+            last_render = -cfg->render_interval;
+        } else {
+            usleep(LOOP_SLEEP_US);
+        }
+    }
+    
+    cleanup_game(&game);
+    clear_screen();
+    show_cursor();
+    if (ended < 0) {
+        disable_raw_mode();
+        printf("Error: Not enough memory for a %dx%d board\n", cfg->board_width, cfg->board_height);
+        return 1;
+    }
+    
+    printf("Replay finished. Final Score: %d\n", game.score);
+    perf_report(active_perf);
+    printf("Press Enter to exit...");
+    
+    disable_raw_mode();
+    getchar();
+    
+    return 0;
+}
+
+int autopilot_direction(Game *game, Config* cfg) {
+    Snake *snake = &game->snake;
+    Point head = snake_segment(snake, 0);
+    int reverse = ((snake->direction - 1) ^ 1) + 1;
+    int best = 0;
+    int best_cost = 0;
+    
+    for (int direction = UP; direction <= RIGHT; direction++) {
+        if (direction == reverse) {
+            continue;
+        }
+        if (!cfg->wraparound_mode &&
+            ((direction == UP && head.y == 0) || (direction == DOWN && head.y == cfg->board_height - 1) ||
+             (direction == LEFT && head.x == 0) || (direction == RIGHT && head.x == cfg->board_width - 1))) {
+            continue;
+        }
+        Point p = step_point(head, direction, cfg);
+        if (game->grid[cell_index(cfg, p)] == CELL_BODY) {
+            continue;
+        }
+        
+        int dx = abs(p.x - game->food.x);
+        int dy = abs(p.y - game->food.y);
+        if (cfg->wraparound_mode) {
+            dx = dx < cfg->board_width - dx ? dx : cfg->board_width - dx;
+            dy = dy < cfg->board_height - dy ? dy : cfg->board_height - dy;
+        }
+        int cost = 2 * (dx + dy) + (direction != snake->direction);
+        if (!best || cost < best_cost) {
+            best = direction;
+            best_cost = cost;
+        }
+    }
+    return best ? best : snake->direction;
+}
+
+int greedy_policy(Pilot *pilot, Game *game, Config* cfg, long long deadline_us) {
+    (void)pilot;
+    (void)deadline_us;
+    return autopilot_direction(game, cfg);
+}
+
+int search_policy(Pilot *pilot, Game *game, Config* cfg, long long deadline_us) {
+    int width = cfg->board_width;
+    Point head = snake_segment(&game->snake, 0);
+    int reverse = ((game->snake.direction - 1) ^ 1) + 1;
+    size_t head_cell = (size_t)head.y * width + head.x;
+    size_t food_cell = (size_t)game->food.y * width + game->food.x;
+    size_t queue_head = 0;
+    size_t queue_tail = 0;
+    
+    for (size_t i = 0; i < pilot->queued; i++) {
+        pilot->first_step[pilot->queue[i]] = 0;
+    }
+    pilot->first_step[head_cell] = reverse;
+    pilot->queue[queue_tail++] = (unsigned int)head_cell;
+    while (queue_head < queue_tail) {
+        if ((queue_head & (PILOT_DEADLINE_CHECK - 1)) == PILOT_DEADLINE_CHECK - 1 && monotonic_us() > deadline_us) {
+            pilot->queued = queue_tail;
+            return 0;
+        }
+        size_t cell = pilot->queue[queue_head++];
+        if (cell == food_cell) {
+            pilot->queued = queue_tail;
+            return pilot->first_step[cell];
+        }
+        Point p = {(int)(cell % width), (int)(cell / width)};
+        for (int direction = UP; direction <= RIGHT; direction++) {
+            if (cell == head_cell && direction == reverse) {
+                continue;
+            }
+            if (!cfg->wraparound_mode &&
+                ((direction == UP && p.y == 0) || (direction == DOWN && p.y == cfg->board_height - 1) ||
+                 (direction == LEFT && p.x == 0) || (direction == RIGHT && p.x == width - 1))) {
+                continue;
+            }
+            Point next = step_point(p, direction, cfg);
+            size_t next_cell = (size_t)next.y * width + next.x;
+            if (pilot->first_step[next_cell] || game->grid[cell_index(cfg, next)] == CELL_BODY) {
+                continue;
+            }
+            pilot->first_step[next_cell] = cell == head_cell ? direction : pilot->first_step[cell];
+            pilot->queue[queue_tail++] = (unsigned int)next_cell;
+        }
+    }
+    pilot->queued = queue_tail;
+    return autopilot_direction(game, cfg);
+}
+
+const Policy policies[] = {
+    {"greedy", greedy_policy},
+    {"search", search_policy}
+};
+
+int pilot_init(Pilot *pilot, const Policy* policy, long long budget_us, Config* cfg) {
+    size_t cell_count = (size_t)cfg->board_width * cfg->board_height;
+    
+    memset(pilot, 0, sizeof(*pilot));
+    pilot->policy = policy;
+    pilot->budget_us = budget_us;
+    pilot->first_step = calloc(cell_count, 1);
+    pilot->queue = malloc(cell_count * sizeof(unsigned int));
+    return pilot->first_step && pilot->queue ? 0 : -1;
+}
+
+void pilot_free(Pilot *pilot) {
+    free(pilot->first_step);
+    free(pilot->queue);
+    memset(pilot, 0, sizeof(*pilot));
+}
+
+int pilot_decide(Pilot *pilot, Game *game, Config* cfg) {
+    long long started = monotonic_us();
+    int direction = pilot->policy->decide(pilot, game, cfg, started + pilot->budget_us);
+    long long latency = monotonic_us() - started;
+    
+    int bucket = 0;
+    while (bucket < PILOT_HISTOGRAM_BUCKETS - 1 && (1LL << bucket) <= latency) {
+        bucket++;
+    }
+    pilot->histogram[bucket]++;
+    pilot->decisions++;
+    pilot->total_us += latency;
+    if (latency > pilot->max_us) {
+        pilot->max_us = latency;
+    }
+    
+    if (!direction || latency > pilot->budget_us) {
+        pilot->overruns++;
+        direction = autopilot_direction(game, cfg);
+    }
+    return direction;
+}
+
+long long pilot_percentile(Pilot *pilot, int percent) {
+    long long target = (pilot->decisions * percent + 99) / 100;
+    long long seen = 0;
+    for (int bucket = 0; bucket < PILOT_HISTOGRAM_BUCKETS; bucket++) {
+        seen += pilot->histogram[bucket];
+        if (seen >= target) {
+            return 1LL << bucket;
+        }
+    }
+    return pilot->max_us;
+}
+
+void pilot_report(Pilot *pilot) {
+    if (pilot->decisions == 0) {
+        return;
+    }
+    printf("Autopilot %s: %lld decisions, mean %lld us, p50 under %lld us, p99 under %lld us, max %lld us\n",
+           pilot->policy->name, pilot->decisions, pilot->total_us / pilot->decisions, pilot_percentile(pilot, 50),
+           pilot_percentile(pilot, 99), pilot->max_us);
+    printf("Budget: %lld us, %lld decisions overran and used the greedy move\n", pilot->budget_us, pilot->overruns);
+    for (int bucket = 0; bucket < PILOT_HISTOGRAM_BUCKETS; bucket++) {
+        if (pilot->histogram[bucket] > 0) {
+            printf("  %lld-%lld us: %lld\n", bucket ? 1LL << (bucket - 1) : 0, 1LL << bucket,
+                   pilot->histogram[bucket]);
+        }
+    }
+}
+
+int write_all(int fd, const void* data, size_t len) {
+    const char* p = data;
+    while (len > 0) {
+        ssize_t written = write(fd, p, len);
+        if (written < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return -1;
+        }
+        p += written;
+        len -= written;
+    }
+    return 0;
+}
+
+void bot_fill_state(Bot *bot, Game *game, BotState *state) {
+    Point head = snake_segment(&game->snake, 0);
+    state->tick = bot->tick;
+    state->game_over = game->game_over;
+    state->score = game->score;
+    state->direction = game->snake.direction;
+    state->length = (unsigned int)game->snake.length;
+    state->head_x = head.x;
+    state->head_y = head.y;
+    state->food_x = game->food.x;
+    state->food_y = game->food.y;
+}
+
+int bot_start(Bot *bot, Game *game, Config* cfg, const char* cmd, int shared) {
+    int to_bot[2];
+    int from_bot[2];
+    int shared_fd = -1;
+    size_t cell_count = (size_t)cfg->board_width * cfg->board_height;
+    
+    memset(bot, 0, sizeof(*bot));
+    bot->to_bot = -1;
+    bot->from_bot = -1;
+    bot->last_head = snake_segment(&game->snake, 0);
+    
+    BotHello hello = {BOT_MAGIC, BOT_VERSION, cfg->board_width, cfg->board_height, 0,
+                      (unsigned int)game->snake.length};
+    hello.flags |= cfg->wraparound_mode ? BOT_FLAG_WRAPAROUND : 0;
+    hello.flags |= cfg->game_mode == MODE_GREEDY ? BOT_FLAG_GREEDY : 0;
+    hello.flags |= shared ? BOT_FLAG_SHARED : 0;
+    
+    if (shared) {
+        bot->shared_size = sizeof(BotShared) + cell_count * sizeof(bot->shared->body[0]);
+        shared_fd = memfd_create("snake-bot", 0);
+        if (shared_fd < 0 || ftruncate(shared_fd, bot->shared_size) != 0) {
+            printf("Error: Cannot create shared memory for the bot: %s\n", strerror(errno));
+            if (shared_fd >= 0) {
+                close(shared_fd);
+            }
+            return 1;
+        }
+        bot->shared = mmap(NULL, bot->shared_size, PROT_READ | PROT_WRITE, MAP_SHARED, shared_fd, 0);
+        if (bot->shared == MAP_FAILED) {
+            printf("Error: Cannot map shared memory for the bot: %s\n", strerror(errno));
+            bot->shared = NULL;
+            close(shared_fd);
+            return 1;
+        }
+        bot->shared->hello = hello;
+        bot->shared->capacity = (unsigned int)cell_count;
+        for (long long i = 0; i < game->snake.length; i++) {
+            Point p = snake_segment(&game->snake, game->snake.length - 1 - i);
+            bot->shared->body[i][0] = p.x;
+            bot->shared->body[i][1] = p.y;
+        }
+        bot->shared->body_head = (unsigned int)game->snake.length - 1;
+    }
+    
+    if (pipe2(to_bot, O_CLOEXEC) != 0) {
+        printf("Error: Cannot create pipes for the bot: %s\n", strerror(errno));
+        if (shared_fd >= 0) {
+            close(shared_fd);
+        }
+        return 1;
+    }
+    if (pipe2(from_bot, O_CLOEXEC) != 0) {
+        printf("Error: Cannot create pipes for the bot: %s\n", strerror(errno));
+        close(to_bot[0]);
+        close(to_bot[1]);
+        if (shared_fd >= 0) {
+            close(shared_fd);
+        }
+        return 1;
+    }
+    signal(SIGPIPE, SIG_IGN);
+    fflush(stdout);
+    bot->pid = fork();
+    if (bot->pid == 0) {
+        dup2(to_bot[0], STDIN_FILENO);
+        dup2(from_bot[1], STDOUT_FILENO);
+        if (shared_fd >= 0) {
+            dup2(shared_fd, BOT_SHARED_FD);
+        }
+        execl("/bin/sh", "sh", "-c", cmd, (char*)NULL);
+        _exit(127);
+    }
+    close(to_bot[0]);
+    close(from_bot[1]);
+    if (shared_fd >= 0) {
+        close(shared_fd);
+    }
+    bot->to_bot = to_bot[1];
+    bot->from_bot = from_bot[0];
+    if (bot->pid < 0) {
+        printf("Error: Cannot start bot '%s': %s\n", cmd, strerror(errno));
+        return 1;
+    }
+    
+    int failed = write_all(bot->to_bot, &hello, sizeof(hello));
+    for (long long i = 0; !failed && !shared && i < game->snake.length; i++) {
+        Point p = snake_segment(&game->snake, i);
+        unsigned int point[2] = {p.x, p.y};
+        failed = write_all(bot->to_bot, point, sizeof(point));
+    }
+    if (failed) {
+        printf("Error: Bot '%s' did not accept the game header\n", cmd);
+        return 1;
+    }
+    return 0;
+}
+
+void bot_publish_begin(BotShared *shared, unsigned int tick) {
+    __atomic_store_n(&shared->state_seq, 2 * tick - 1, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+}
+
+void bot_publish_end(BotShared *shared, unsigned int tick) {
+    __atomic_store_n(&shared->state_seq, 2 * tick, __ATOMIC_RELEASE);
+}
+
+int bot_wait_shared(Bot *bot, unsigned int seq, long long deadline_us) {
+    for (int spins = 0; __atomic_load_n(&bot->shared->action_seq, __ATOMIC_ACQUIRE) != seq; spins++) {
+        if (spins >= BOT_SPIN_LIMIT) {
+            if (monotonic_us() > deadline_us) {
+                return waitpid(bot->pid, NULL, WNOHANG) == 0 ? 0 : -1;
+            }
+            sched_yield();
+        }
+    }
+    bot->reply = bot->shared->action;
+    return 1;
+}
+
+int bot_wait_pipe(Bot *bot, long long deadline_us) {
+    while (1) {
+        long long remaining = deadline_us - monotonic_us();
+        if (remaining < 0) {
+            return 0;
+        }
+        struct pollfd pfd = {bot->from_bot, POLLIN, 0};
+        struct timespec timeout = {remaining / MICROSECONDS_PER_SECOND, remaining % MICROSECONDS_PER_SECOND * 1000};
+        int ready = ppoll(&pfd, 1, &timeout, NULL);
+        if (ready < 0 && errno != EINTR) {
+            return -1;
+        }
+        if (ready <= 0) {
+            continue;
+        }
+        ssize_t got = read(bot->from_bot, (char*)&bot->reply + bot->reply_len, sizeof(bot->reply) - bot->reply_len);
+        if (got <= 0) {
+            if (got < 0 && errno == EINTR) {
+                continue;
+            }
+            return -1;
+        }
+        bot->reply_len += got;
+        if (bot->reply_len == sizeof(bot->reply)) {
+            bot->reply_len = 0;
+            if (bot->reply.tick == bot->tick) {
+                return 1;
+            }
+        }
+    }
+}
+
+int bot_policy(Pilot *pilot, Game *game, Config* cfg, long long deadline_us) {
+    Bot *bot = pilot->bot;
+    int reverse = ((game->snake.direction - 1) ^ 1) + 1;
+    int result;
+    (void)cfg;
+    
+    if (bot->failed) {
+        return 0;
+    }
+    bot->tick++;
+    if (bot->shared) {
+        BotShared *shared = bot->shared;
+        Point head = snake_segment(&game->snake, 0);
+        bot_publish_begin(shared, bot->tick);
+        if (head.x != bot->last_head.x || head.y != bot->last_head.y) {
+            unsigned int slot = ++shared->body_head % shared->capacity;
+            shared->body[slot][0] = head.x;
+            shared->body[slot][1] = head.y;
+            bot->last_head = head;
+        }
+        bot_fill_state(bot, game, &shared->state);
+        bot_publish_end(shared, bot->tick);
+        result = bot_wait_shared(bot, bot->tick, deadline_us);
+    } else {
+        BotState state;
+        bot_fill_state(bot, game, &state);
+        result = write_all(bot->to_bot, &state, sizeof(state)) == 0 ? bot_wait_pipe(bot, deadline_us) : -1;
+    }
+    
+    if (result < 0) {
+        bot->failed = 1;
+    }
+    if (result <= 0) {
+        return 0;
+    }
+    int direction = (int)bot->reply.direction;
+    if (direction < UP || direction > RIGHT || direction == reverse) {
+        direction = game->snake.direction;
+    }
+    return direction;
+}
+
+void bot_stop(Bot *bot, Game *game) {
+    if (bot->pid > 0 && !bot->failed) {
+        bot->tick++;
+        if (bot->shared) {
+            bot_publish_begin(bot->shared, bot->tick);
+            bot_fill_state(bot, game, &bot->shared->state);
+            bot->shared->state.game_over = 1;
+            bot_publish_end(bot->shared, bot->tick);
+        } else {
+            BotState state;
+            bot_fill_state(bot, game, &state);
+            state.game_over = 1;
+            write_all(bot->to_bot, &state, sizeof(state));
+        }
+    }
+    if (bot->to_bot >= 0) {
+        close(bot->to_bot);
+    }
+    if (bot->from_bot >= 0) {
+        close(bot->from_bot);
+    }
+    if (bot->pid > 0) {
+        kill(bot->pid, SIGTERM);
+        waitpid(bot->pid, NULL, 0);
+    }
+    if (bot->shared) {
+        munmap(bot->shared, bot->shared_size);
+    }
+    memset(bot, 0, sizeof(*bot));
+}
+
+const Policy bot_pilot_policy = {"bot", bot_policy};
+
+long long shard_claim(Shard *shard) {
+    pthread_mutex_lock(&shard->lock);
+    long long game = shard->next_game < shard->end_game ? shard->next_game++ : -1;
+    pthread_mutex_unlock(&shard->lock);
+    return game;
+}
+
+long long shard_steal(Batch *batch, Shard *thief) {
+    while (1) {
+        Shard* victim = NULL;
+        long long most = 0;
+        for (int i = 0; i < batch->shard_count; i++) {
+            Shard* shard = &batch->shards[i];
+            if (shard == thief) {
+                continue;
+            }
+            pthread_mutex_lock(&shard->lock);
+            long long remaining = shard->end_game - shard->next_game;
+            pthread_mutex_unlock(&shard->lock);
+            if (remaining > most) {
+                most = remaining;
+                victim = shard;
+            }
+        }
+        if (!victim) {
+            return -1;
+        }
+        
+        pthread_mutex_lock(&victim->lock);
+        long long remaining = victim->end_game - victim->next_game;
+        long long take = (remaining + 1) / 2;
+        long long start = victim->end_game - take;
+        if (take > 0) {
+            victim->end_game = start;
+        }
+        pthread_mutex_unlock(&victim->lock);
+        if (take <= 0) {
+            continue;
+        }
+        
+        pthread_mutex_lock(&thief->lock);
+        thief->next_game = start + 1;
+        thief->end_game = start + take;
+        pthread_mutex_unlock(&thief->lock);
+        thief->steals++;
+        return start;
+    }
+}
+
+unsigned long long batch_game_hash(long long index, int score, long long ticks) {
+    unsigned long long h = (unsigned long long)index * 0x9E3779B97F4A7C15ULL;
+    h ^= ((unsigned long long)score << 32) ^ (unsigned long long)ticks;
+    h ^= h >> 31;
+    h *= 0xBF58476D1CE4E5B9ULL;
+    h ^= h >> 29;
+    return h;
+}
+
+const DatasetColumnInfo dataset_columns[DATASET_COLUMNS] = {
+    [DATASET_GAME] = {"game", "u32", 4},
+    [DATASET_TICK] = {"tick", "u32", 4},
+    [DATASET_HEAD_X] = {"head_x", "u16", 2},
+    [DATASET_HEAD_Y] = {"head_y", "u16", 2},
+    [DATASET_FOOD_X] = {"food_x", "u16", 2},
+    [DATASET_FOOD_Y] = {"food_y", "u16", 2},
+    [DATASET_LENGTH] = {"length", "u32", 4},
+    [DATASET_DIRECTION] = {"direction", "u8", 1},
+    [DATASET_ACTION] = {"action", "u8", 1},
+    [DATASET_REWARD] = {"reward", "i8", 1},
+    [DATASET_DONE] = {"done", "u8", 1},
+    [DATASET_BOARD] = {"board", "bits", 0}
+};
+
+int dataset_open(Dataset *ds, Config* cfg, const char* dir, long long games) {
+    memset(ds, 0, sizeof(*ds));
+    for (int c = 0; c < DATASET_COLUMNS; c++) {
+        ds->fds[c] = -1;
+    }
+    if (cfg->board_width > 0xFFFF || cfg->board_height > 0xFFFF || games > 0xFFFFFFFFLL) {
+        printf("Error: --dump-dataset supports boards up to 65535 cells per side and 2^32 games\n");
+        return 1;
+    }
+    if (mkdir(dir, 0755) != 0 && errno != EEXIST) {
+        printf("Error: Cannot create dataset directory '%s': %s\n", dir, strerror(errno));
+        return 1;
+    }
+    
+    ds->dir = dir;
+    ds->cell_count = (size_t)cfg->board_width * cfg->board_height;
+    size_t row_bytes = 0;
+    for (int c = 0; c < DATASET_COLUMNS; c++) {
+        ds->widths[c] = c == DATASET_BOARD ? (int)((ds->cell_count + 7) / 8) : dataset_columns[c].width;
+        row_bytes += ds->widths[c];
+    }
+    ds->block_rows = row_bytes < DATASET_BLOCK_BYTES ? (int)(DATASET_BLOCK_BYTES / row_bytes) : 1;
+    for (int c = 0; c < DATASET_COLUMNS; c++) {
+        char path[PATH_MAX];
+        snprintf(path, sizeof(path), "%s/%s.bin", dir, dataset_columns[c].name);
+        ds->fds[c] = open(path, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+        if (ds->fds[c] < 0) {
+            printf("Error: Cannot create '%s': %s\n", path, strerror(errno));
+            ds->failed = 1;
+            return 1;
+        }
+    }
+    return 0;
+}
+
+int dataset_block_init(DatasetBlock *block, Dataset *ds) {
+    memset(block, 0, sizeof(*block));
+    for (int c = 0; c < DATASET_COLUMNS; c++) {
+        block->columns[c] = malloc((size_t)ds->widths[c] * ds->block_rows);
+        if (!block->columns[c]) {
+            return -1;
+        }
+    }
+    block->cells = malloc(ds->cell_count + 8);
+    return block->cells ? 0 : -1;
+}
+
+void dataset_flush(DatasetBlock *block, Dataset *ds) {
+    if (block->count == 0) {
+        return;
+    }
+    long long start = __atomic_fetch_add(&ds->rows, block->count, __ATOMIC_RELAXED);
+    for (int c = 0; c < DATASET_COLUMNS; c++) {
+        size_t len = (size_t)ds->widths[c] * block->count;
+        off_t offset = (off_t)start * ds->widths[c];
+        const unsigned char* data = block->columns[c];
+        while (len > 0) {
+            ssize_t written = pwrite(ds->fds[c], data, len, offset);
+            if (written < 0 && errno == EINTR) {
+                continue;
+            }
+            if (written <= 0) {
+                __atomic_store_n(&ds->failed, 1, __ATOMIC_RELAXED);
+                break;
+            }
+            data += written;
+            len -= written;
+            offset += written;
+        }
+    }
+    block->count = 0;
+}
+
+void dataset_block_free(DatasetBlock *block, Dataset *ds) {
+    dataset_flush(block, ds);
+    for (int c = 0; c < DATASET_COLUMNS; c++) {
+        free(block->columns[c]);
+    }
+    free(block->cells);
+    memset(block, 0, sizeof(*block));
+}
+
+void dataset_capture(DatasetBlock *block, Dataset *ds, Game *game, Config* cfg, long long index, long long tick) {
+    int row = block->count;
+    Point head = snake_segment(&game->snake, 0);
+    unsigned int game_index = (unsigned int)index;
+    unsigned int tick32 = (unsigned int)tick;
+    unsigned short coords[4] = {head.x, head.y, game->food.x, game->food.y};
+    unsigned int length = (unsigned int)game->snake.length;
+    
+    memcpy(block->columns[DATASET_GAME] + row * 4, &game_index, 4);
+    memcpy(block->columns[DATASET_TICK] + row * 4, &tick32, 4);
+    for (int i = 0; i < 4; i++) {
+        memcpy(block->columns[DATASET_HEAD_X + i] + row * 2, &coords[i], 2);
+    }
+    memcpy(block->columns[DATASET_LENGTH] + row * 4, &length, 4);
+    block->columns[DATASET_DIRECTION][row] = (unsigned char)game->snake.direction;
+    
+    unsigned char* bits = block->columns[DATASET_BOARD] + (size_t)row * ds->widths[DATASET_BOARD];
+    fill_cells(game, cfg, block->cells);
+    memset(block->cells + ds->cell_count, CELL_EMPTY, 8);
+    for (int b = 0; b < ds->widths[DATASET_BOARD]; b++) {
+        unsigned long long v;
+        memcpy(&v, block->cells + (size_t)b * 8, 8);
+        v = (v ^ (v >> 1)) & 0x0101010101010101ULL;
+        bits[b] = (unsigned char)((v * 0x0102040810204080ULL) >> 56);
+    }
+}
+
+void dataset_commit(DatasetBlock *block, Dataset *ds, int action, int reward, int done) {
+    int row = block->count;
+    block->columns[DATASET_ACTION][row] = (unsigned char)action;
+    block->columns[DATASET_REWARD][row] = (unsigned char)(signed char)reward;
+    block->columns[DATASET_DONE][row] = (unsigned char)done;
+    if (++block->count == ds->block_rows) {
+        dataset_flush(block, ds);
+    }
+}
+
+int dataset_close(Dataset *ds, Config* cfg) {
+    int failed = ds->failed;
+    for (int c = 0; c < DATASET_COLUMNS; c++) {
+        if (ds->fds[c] >= 0 && close(ds->fds[c]) != 0) {
+            failed = 1;
+        }
+    }
+    
+    if (ds->dir && !failed) {
+        char path[PATH_MAX];
+        snprintf(path, sizeof(path), "%s/schema.txt", ds->dir);
+        FILE* schema = fopen(path, "w");
+        if (schema) {
+            fprintf(schema, "rows %lld\nboard %d %d\nbyteorder %s\n", ds->rows, cfg->board_width, cfg->board_height,
+                    __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__ ? "little" : "big");
+            for (int c = 0; c < DATASET_COLUMNS; c++) {
+                fprintf(schema, "column %s %s %d\n", dataset_columns[c].name, dataset_columns[c].type, ds->widths[c]);
+            }
+            int lsb_first = __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__;
+            fprintf(schema, "bitorder %s: board cell i (row-major, i = y * %d + x) is bit %s of byte i / 8\n",
+                    lsb_first ? "lsb-first" : "msb-first", cfg->board_width, lsb_first ? "i % 8" : "7 - i % 8");
+            fprintf(schema, "bitpacking continuous: board rows follow each other without padding, "
+                    "%zu cells in ceil(%zu / 8) = %d bytes per sample, unused trailing bits are 0\n",
+                    ds->cell_count, ds->cell_count, ds->widths[DATASET_BOARD]);
+            fprintf(schema, "bitvalue 1 for snake head and body cells, 0 for empty and food cells\n");
+            failed |= fclose(schema) != 0;
+        } else {
+            failed = 1;
+        }
+    }
+    if (failed && ds->dir) {
+        printf("Error: Failed writing the dataset to '%s'\n", ds->dir);
+    }
+    return failed;
+}
+
+void* shard_worker(void* arg) {
+    Shard *shard = arg;
+    Batch *batch = shard->batch;
+    Config* cfg = batch->cfg;
+    
+    pin_thread(shard->cpu);
+    
+    size_t cell_count = board_cells(cfg);
+    long long max_length = (long long)cfg->board_width * cfg->board_height;
+    Game game = {0};
+    if (arena_init(&shard->arena, cell_count + ARENA_ALIGN + snake_arena_size(max_length)) != 0 ||
+        !(game.grid = arena_alloc(&shard->arena, cell_count)) ||
+        snake_init(&game.snake, max_length, &shard->arena) != 0 ||
+        (batch->dataset && dataset_block_init(&shard->dataset, batch->dataset) != 0)) {
+        shard->failed = 1;
+        if (batch->dataset) {
+            dataset_block_free(&shard->dataset, batch->dataset);
+        }
+        snake_free(&game.snake);
+        arena_free(&shard->arena);
+        return NULL;
+    }
+    shard->memory = board_memory_name(shard->arena.base);
+    
+    while (1) {
+        long long index = shard_claim(shard);
+        if (index < 0) {
+            index = shard_steal(batch, shard);
+        }
+        if (index < 0) {
+            break;
+        }
+        
+        if (reset_game(&game, cfg, batch->seed + (unsigned long long)index * 0x9E3779B97F4A7C15ULL) != 0) {
+            shard->failed = 1;
+            break;
+        }
+        long long ticks = 0;
+        while (!game.game_over && ticks < batch->max_ticks) {
+            int direction = autopilot_direction(&game, cfg);
+            if (batch->dataset) {
+                int score = game.score;
+                dataset_capture(&shard->dataset, batch->dataset, &game, cfg, index, ticks);
+                game.snake.direction = direction;
+                move_snake(&game, cfg);
+                dataset_commit(&shard->dataset, batch->dataset, direction,
+                               game.score > score ? 1 : game.game_over ? -1 : 0,
+                               game.game_over || ticks + 1 >= batch->max_ticks);
+            } else {
+                game.snake.direction = direction;
+                move_snake(&game, cfg);
+            }
+            ticks++;
+        }
+        
+        shard->games++;
+        shard->ticks += ticks;
+        shard->score_total += game.score;
+        shard->capped += !game.game_over;
+        if (game.score > shard->best_score) {
+            shard->best_score = game.score;
+        }
+        shard->checksum ^= batch_game_hash(index, game.score, ticks);
+    }
+    
+    if (batch->dataset) {
+        dataset_block_free(&shard->dataset, batch->dataset);
+    }
+    snake_free(&game.snake);
+    arena_free(&shard->arena);
+    return NULL;
+}
+
+int run_batch(Config* cfg, long long games) {
+    Batch batch = {0};
+    batch.cfg = cfg;
+    batch.seed = game_seed;
+    batch.max_ticks = (long long)cfg->board_width * cfg->board_height * BATCH_MAX_TICKS_PER_CELL;
+    batch.shard_count = thread_count();
+    
+    Dataset dataset;
+    if (dataset_dir) {
+        if (dataset_open(&dataset, cfg, dataset_dir, games) != 0) {
+            dataset_close(&dataset, cfg);
+            return 1;
+        }
+        batch.dataset = &dataset;
+    }
+    
+    int cpus[CPU_SETSIZE];
+    int cpu_count = allowed_cpus(cpus);
+    
+    batch.shards = aligned_alloc(64, batch.shard_count * sizeof(Shard));
+    memset(batch.shards, 0, batch.shard_count * sizeof(Shard));
+    for (int i = 0; i < batch.shard_count; i++) {
+        Shard* shard = &batch.shards[i];
+        shard->batch = &batch;
+        shard->index = i;
+        shard->cpu = cpu_count > 0 ? cpus[i % cpu_count] : -1;
+        shard->next_game = games * i / batch.shard_count;
+        shard->end_game = games * (i + 1) / batch.shard_count;
+        pthread_mutex_init(&shard->lock, NULL);
+    }
+    
+    printf("Batch: %lld games of %dx%d on %d shards, seed %llu\n", games,
+           cfg->board_width, cfg->board_height, batch.shard_count, batch.seed);
+    fflush(stdout);
+    
+    long long started = monotonic_us();
+    for (int i = 0; i < batch.shard_count; i++) {
+        pthread_create(&batch.shards[i].thread, NULL, shard_worker, &batch.shards[i]);
+    }
+    for (int i = 0; i < batch.shard_count; i++) {
+        pthread_join(batch.shards[i].thread, NULL);
+    }
+    long long elapsed = monotonic_us() - started;
+    
+    long long ticks = 0;
+    long long score_total = 0;
+    long long capped = 0;
+    int best_score = 0;
+    int failed = 0;
+    unsigned long long checksum = 0;
+    for (int i = 0; i < batch.shard_count; i++) {
+        Shard* shard = &batch.shards[i];
+        ticks += shard->ticks;
+        score_total += shard->score_total;
+        capped += shard->capped;
+        failed |= shard->failed;
+        checksum ^= shard->checksum;
+        if (shard->best_score > best_score) {
+            best_score = shard->best_score;
+        }
+    }
+    
+    if (failed) {
+        printf("Error: Not enough memory for a %dx%d game%s in each shard\n", cfg->board_width,
+               cfg->board_height, batch.dataset ? " and its dataset block" : "");
+    } else {
+        printf("Finished in %lld ms: %lld ticks (%lld ticks/s)\n", elapsed / 1000, ticks,
+               elapsed > 0 ? ticks * MICROSECONDS_PER_SECOND / elapsed : 0);
+        printf("Scores: average %lld, best %d, %lld games hit the tick limit\n",
+               games > 0 ? score_total / games : 0, best_score, capped);
+        printf("Checksum: %016llx\n", checksum);
+        printf("Board memory: %zu KB per shard in %s, %s layout\n",
+               (board_cells(cfg) + 1023) / 1024, batch.shards[0].memory, BOARD_LAYOUT_NAME);
+        for (int i = 0; i < batch.shard_count; i++) {
+            Shard* shard = &batch.shards[i];
+            printf("Shard %d (cpu %d): %lld games, %lld ticks, %lld steals\n", i, shard->cpu,
+                   shard->games, shard->ticks, shard->steals);
+        }
+    }
+    if (batch.dataset) {
+        failed |= dataset_close(&dataset, cfg);
+        if (!failed) {
+            printf("Dataset: %lld samples in %d columns under %s\n", dataset.rows, DATASET_COLUMNS, dataset_dir);
+        }
+    }
+    
+    for (int i = 0; i < batch.shard_count; i++) {
+        pthread_mutex_destroy(&batch.shards[i].lock);
+    }
+    free(batch.shards);
+    return failed;
+}
+
+int solve_neighbor(Solver *solver, int cell, int direction) {
+    Point p = {cell % solver->width, cell / solver->width};
+    if (!solver->cfg->wraparound_mode &&
+        ((direction == UP && p.y == 0) || (direction == DOWN && p.y == solver->height - 1) ||
+         (direction == LEFT && p.x == 0) || (direction == RIGHT && p.x == solver->width - 1))) {
+        return -1;
+    }
+    p = step_point(p, direction, solver->cfg);
+    return p.y * solver->width + p.x;
+}
+
+void solver_init_transforms(Solver *solver) {
+    int w = solver->width;
+    int h = solver->height;
+    int count = w == h ? 8 : 4;
+    
+    for (int t = 0; t < count; t++) {
+        for (int y = 0; y < h; y++) {
+            for (int x = 0; x < w; x++) {
+                int tx = (t & 1) ? w - 1 - x : x;
+                int ty = (t & 2) ? h - 1 - y : y;
+                if (t & 4) {
+                    int swap = tx;
+                    tx = ty;
+                    ty = swap;
+                }
+                solver->transforms[t][y * w + x] = (unsigned char)(ty * w + tx);
+            }
+        }
+    }
+    solver->transform_count = count;
+}
+
+unsigned long long solve_hash(unsigned long long a, unsigned long long b) {
+    unsigned long long h = (a ^ (b * 0x9E3779B97F4A7C15ULL)) * 0xBF58476D1CE4E5B9ULL;
+    return h ^ (h >> 31);
+}
+
+int solver_can_fill(Solver *solver, SolveWorker *worker, unsigned long long mask, int head) {
+    if (mask == solver->full_mask) {
+        return 1;
+    }
+    
+    unsigned long long key_mask = ~0ULL;
+    int key_head = 0;
+    for (int t = 0; t < solver->transform_count; t++) {
+        unsigned long long m = 0;
+        for (unsigned long long bits = mask; bits; bits &= bits - 1) {
+            m |= 1ULL << solver->transforms[t][__builtin_ctzll(bits)];
+        }
+        int hd = solver->transforms[t][head];
+        if (m < key_mask || (m == key_mask && hd < key_head)) {
+            key_mask = m;
+            key_head = hd;
+        }
+    }
+    FillEntry *entry = &worker->fill_memo[solve_hash(key_mask, key_head) & (SOLVE_MEMO_SIZE - 1)];
+    if (entry->mask == key_mask && entry->head == key_head) {
+        worker->hits++;
+        return entry->fillable;
+    }
+    worker->states++;
+    
+    int fillable = 0;
+    for (int direction = UP; direction <= RIGHT && !fillable; direction++) {
+        int next = solver->neighbors[head][direction - 1];
+        if (next >= 0 && !(mask >> next & 1)) {
+            fillable = solver_can_fill(solver, worker, mask | 1ULL << next, next);
+        }
+    }
+    entry = &worker->fill_memo[solve_hash(key_mask, key_head) & (SOLVE_MEMO_SIZE - 1)];
+    entry->mask = key_mask;
+    entry->head = (unsigned char)key_head;
+    entry->fillable = (unsigned char)fillable;
+    return fillable;
+}
+
+int solver_place_food(Solver *solver, SolveState *state) {
+    if (__builtin_popcountll(state->mask) >= solver->cells) {
+        return 0;
+    }
+    for (long long attempts = 0; attempts < (long long)solver->cells * FOOD_PLACEMENT_MAX_ATTEMPTS_MULTIPLIER; attempts++) {
+        int x = rng_next(&state->rng_state) % solver->width;
+        int y = rng_next(&state->rng_state) % solver->height;
+        if (!(state->mask >> (y * solver->width + x) & 1)) {
+            state->food = y * solver->width + x;
+            return 1;
+        }
+    }
+    return 0;
+}
+
+int solver_step(Solver *solver, SolveState *state, int direction, int *ate) {
+    int next = solver->neighbors[state->head][direction - 1];
+    *ate = 0;
+    if (next < 0 || (state->mask >> next & 1)) {
+        return -1;
+    }
+    state->mask |= 1ULL << next;
+    state->head = next;
+    if (next != state->food) {
+        return 1;
+    }
+    *ate = 1;
+    return solver_place_food(solver, state);
+}
+
+SolveEntry* solver_lookup(SolveWorker *worker, SolveState *state) {
+    unsigned long long key = solve_hash(state->mask, state->rng_state ^ ((unsigned long long)state->head << 8 | state->food));
+    return &worker->memo[key & (SOLVE_MEMO_SIZE - 1)];
+}
+
+int solver_search(Solver *solver, SolveWorker *worker, SolveState *state, int *won) {
+    SolveEntry *entry = solver_lookup(worker, state);
+    if (entry->mask == state->mask && entry->rng_state == state->rng_state &&
+        entry->head == state->head && entry->food == state->food) {
+        worker->hits++;
+        *won = entry->won;
+        return entry->foods;
+    }
+    worker->states++;
+    
+    int best = 0;
+    int best_move = 0;
+    *won = state->mask == solver->full_mask;
+    for (int direction = UP; direction <= RIGHT; direction++) {
+        SolveState child = *state;
+        int ate;
+        int alive = solver_step(solver, &child, direction, &ate);
+        if (alive < 0) {
+            continue;
+        }
+        int child_won = child.mask == solver->full_mask;
+        int foods = ate + (alive ? solver_search(solver, worker, &child, &child_won) : 0);
+        if (!best_move || foods > best) {
+            best = foods;
+            best_move = direction;
+        }
+        *won |= child_won;
+    }
+    
+    entry = solver_lookup(worker, state);
+    entry->mask = state->mask;
+    entry->rng_state = state->rng_state;
+    entry->head = (unsigned char)state->head;
+    entry->food = (unsigned char)state->food;
+    entry->foods = (unsigned char)best;
+    entry->won = (unsigned char)*won;
+    entry->move = (unsigned char)best_move;
+    return best;
+}
+
+void* solve_worker(void* arg) {
+    SolveWorker *worker = arg;
+    Solver *solver = worker->solver;
+    
+    while (1) {
+        int index = __atomic_fetch_add(&solver->next_task, 1, __ATOMIC_RELAXED);
+        if (index >= solver->task_count) {
+            break;
+        }
+        SolveTask *task = &solver->tasks[index];
+        if (!task->ended) {
+            task->foods += solver_search(solver, worker, &task->state, &task->won);
+        }
+    }
+    return NULL;
+}
+
+int solver_expand(Solver *solver, int target) {
+    for (int depth = 0; depth < SOLVE_MAX_SPLIT_DEPTH && solver->task_count < target; depth++) {
+        int count = solver->task_count;
+        SolveTask* next = malloc((size_t)count * 4 * sizeof(SolveTask));
+        int next_count = 0;
+        int expanded = 0;
+        if (!next) {
+            return -1;
+        }
+        for (int i = 0; i < count; i++) {
+            SolveTask *task = &solver->tasks[i];
+            int moves = 0;
+            for (int direction = UP; direction <= RIGHT && !task->ended; direction++) {
+                SolveTask child = *task;
+                int ate;
+                int alive = solver_step(solver, &child.state, direction, &ate);
+                if (alive < 0) {
+                    continue;
+                }
+                child.path[child.depth++] = (unsigned char)direction;
+                child.foods += ate;
+                child.ended = !alive;
+                child.won = child.state.mask == solver->full_mask;
+                next[next_count++] = child;
+                moves++;
+            }
+            if (!moves) {
+                task->ended = 1;
+                next[next_count++] = *task;
+            } else {
+                expanded = 1;
+            }
+        }
+        free(solver->tasks);
+        solver->tasks = next;
+        solver->task_count = next_count;
+        if (!expanded) {
+            break;
+        }
+    }
+    return 0;
+}
+
+int run_solver(Config* cfg) {
+    Solver solver = {0};
+    solver.cfg = cfg;
+    solver.width = cfg->board_width;
+    solver.height = cfg->board_height;
+    solver.cells = solver.width * solver.height;
+    if (solver.width < SOLVE_MIN_WIDTH || solver.cells > SOLVE_MAX_CELLS) {
+        printf("Error: --solve needs a board at least %d wide with at most %d cells\n", SOLVE_MIN_WIDTH,
+               SOLVE_MAX_CELLS);
+        return 1;
+    }
+    cfg->game_mode = MODE_GREEDY;
+    solver.full_mask = solver.cells == 64 ? ~0ULL : (1ULL << solver.cells) - 1;
+    for (int cell = 0; cell < solver.cells; cell++) {
+        for (int direction = UP; direction <= RIGHT; direction++) {
+            solver.neighbors[cell][direction - 1] = (signed char)solve_neighbor(&solver, cell, direction);
+        }
+    }
+    solver_init_transforms(&solver);
+    
+    Game game;
+    if (init_game(&game, cfg, game_seed) != 0) {
+        printf("Error: Not enough memory for a %dx%d board\n", cfg->board_width, cfg->board_height);
+        return 1;
+    }
+    SolveState start = {0, game.rng_state, 0, game.food.y * solver.width + game.food.x};
+    for (long long i = 0; i < game.snake.length; i++) {
+        Point p = snake_segment(&game.snake, i);
+        start.mask |= 1ULL << (p.y * solver.width + p.x);
+    }
+    Point head = snake_segment(&game.snake, 0);
+    start.head = head.y * solver.width + head.x;
+    cleanup_game(&game);
+    
+    int worker_count = thread_count();
+    SolveWorker* workers = calloc(worker_count, sizeof(SolveWorker));
+    solver.tasks = calloc(1, sizeof(SolveTask));
+    solver.tasks[0].state = start;
+    solver.task_count = 1;
+    int failed = !workers || !solver.tasks;
+    for (int w = 0; !failed && w < worker_count; w++) {
+        workers[w].solver = &solver;
+        workers[w].memo = calloc(SOLVE_MEMO_SIZE, sizeof(SolveEntry));
+        failed |= !workers[w].memo;
+    }
+    if (!failed) {
+        workers[0].fill_memo = calloc(SOLVE_MEMO_SIZE, sizeof(FillEntry));
+        failed |= !workers[0].fill_memo || solver_expand(&solver, worker_count * SOLVE_TASKS_PER_THREAD) != 0;
+    }
+    if (failed) {
+        printf("Error: Not enough memory for the solver\n");
+        for (int w = 0; workers && w < worker_count; w++) {
+            free(workers[w].memo);
+            free(workers[w].fill_memo);
+        }
+        free(workers);
+        free(solver.tasks);
+        return 1;
+    }
+    
+    printf("Solve: %dx%d greedy board%s, seed %llu, %d tasks on %d threads\n", solver.width, solver.height,
+           cfg->wraparound_mode ? " with wraparound" : "", game_seed, solver.task_count, worker_count);
+    fflush(stdout);
+    
+    long long started = monotonic_us();
+    int fillable = solver_can_fill(&solver, &workers[0], start.mask, start.head);
+    long long fill_elapsed = monotonic_us() - started;
+    long long fill_states = workers[0].states;
+    workers[0].states = 0;
+    workers[0].hits = 0;
+    
+    started = monotonic_us();
+    for (int w = 1; w < worker_count; w++) {
+        pthread_create(&workers[w].thread, NULL, solve_worker, &workers[w]);
+    }
+    solve_worker(&workers[0]);
+    for (int w = 1; w < worker_count; w++) {
+        pthread_join(workers[w].thread, NULL);
+    }
+    long long elapsed = monotonic_us() - started;
+    
+    long long states = 0;
+    long long hits = 0;
+    for (int w = 0; w < worker_count; w++) {
+        states += workers[w].states;
+        hits += workers[w].hits;
+    }
+    SolveTask *best = &solver.tasks[0];
+    int winnable = 0;
+    for (int i = 0; i < solver.task_count; i++) {
+        if (solver.tasks[i].foods > best->foods) {
+            best = &solver.tasks[i];
+        }
+        winnable |= solver.tasks[i].won;
+    }
+    
+    unsigned char path[SOLVE_MAX_CELLS];
+    int path_length = best->depth;
+    memcpy(path, best->path, best->depth);
+    SolveState state = best->state;
+    while (!best->ended) {
+        int won;
+        solver_search(&solver, &workers[0], &state, &won);
+        int direction = solver_lookup(&workers[0], &state)->move;
+        int ate;
+        if (!direction || solver_step(&solver, &state, direction, &ate) <= 0) {
+            if (direction) {
+                path[path_length++] = (unsigned char)direction;
+            }
+            break;
+        }
+        path[path_length++] = (unsigned char)direction;
+    }
+    
+    ReplayWriter recorder = {0};
+    if (record_path && replay_writer_open(&recorder, record_path, cfg, game_seed) != 0) {
+        failed = 1;
+    }
+    int replayed = init_game(&game, cfg, game_seed) == 0;
+    if (!replayed) {
+        printf("Error: Not enough memory for a %dx%d board\n", cfg->board_width, cfg->board_height);
+        failed = 1;
+    }
+    for (int i = 0; replayed && i < path_length && !game.game_over; i++) {
+        game.snake.direction = path[i];
+        replay_writer_tick(&recorder, &game);
+        move_snake(&game, cfg);
+    }
+    failed |= replay_writer_close(&recorder);
+    
+    printf("Fill: the board %s be filled from the start (%lld states in %lld ms)\n", fillable ? "can" : "cannot",
+           fill_states, fill_elapsed / 1000);
+    printf("Game: best score %d in %d moves, the game %s be won with this seed\n", best->foods * POINTS_PER_FOOD,
+           path_length, winnable ? "can" : "cannot");
+    printf("Searched %lld states in %lld ms (%lld states/s), %lld memo hits\n", states, elapsed / 1000,
+           elapsed > 0 ? states * MICROSECONDS_PER_SECOND / elapsed : 0, hits);
+    if (replayed && game.score != best->foods * POINTS_PER_FOOD) {
+        printf("Error: Replaying the best line in the engine scored %d\n", game.score);
+        failed = 1;
+    } else if (record_path && !failed) {
+        printf("Recorded the best line to %s\n", record_path);
+    }
+    cleanup_game(&game);
+    
+    for (int w = 0; w < worker_count; w++) {
+        free(workers[w].memo);
+        free(workers[w].fill_memo);
+    }
+    free(workers);
+    free(solver.tasks);
+    return failed;
+}
+
+int swarm_tile(Swarm *swarm, unsigned int cell) {
+    Point p = cell_point(swarm->cfg, cell);
+    return (p.y >> SWARM_TILE_BITS) * swarm->tiles_x + (p.x >> SWARM_TILE_BITS);
+}
+
+unsigned int swarm_step(Swarm *swarm, unsigned int cell, int direction) {
+    Config* cfg = swarm->cfg;
+    Point p = cell_point(cfg, cell);
+    
+    if (!cfg->wraparound_mode &&
+        ((direction == UP && p.y == 0) || (direction == DOWN && p.y == cfg->board_height - 1) ||
+         (direction == LEFT && p.x == 0) || (direction == RIGHT && p.x == cfg->board_width - 1))) {
+        return SWARM_WALL;
+    }
+    p = step_point(p, direction, cfg);
+    return (unsigned int)cell_index(cfg, p);
+}
+
+int swarm_choose_direction(Swarm *swarm, SwarmSnake *snake) {
+    unsigned int head = snake->body[snake->head];
+    int reverse = ((snake->direction - 1) ^ 1) + 1;
+    int safe[4];
+    int safe_count = 0;
+    int straight_safe = 0;
+    
+    for (int direction = UP; direction <= RIGHT; direction++) {
+        if (direction == reverse && snake->length > 1) {
+            continue;
+        }
+        unsigned int next = swarm_step(swarm, head, direction);
+        if (next == SWARM_WALL) {
+            continue;
+        }
+        int cell = swarm->grid[next];
+        if (cell == CELL_FOOD) {
+            return direction;
+        }
+        if (cell == CELL_EMPTY) {
+            safe[safe_count++] = direction;
+            straight_safe |= direction == snake->direction;
+        }
+    }
+    
+    unsigned int roll = rng_next(&snake->rng_state);
+    if (safe_count == 0 || (straight_safe && roll % SWARM_TURN_ODDS != 0)) {
+        return snake->direction;
+    }
+    return safe[(roll / SWARM_TURN_ODDS) % safe_count];
+}
+
+void swarm_plan(SwarmWorker *worker) {
+    Swarm *swarm = worker->swarm;
+    
+    memset(worker->tile_start, 0, (swarm->tile_count + 1) * sizeof(int));
+    for (int i = worker->first_snake; i < worker->end_snake; i++) {
+        SwarmSnake *snake = &swarm->snakes[i];
+        if (!snake->alive) {
+            continue;
+        }
+        snake->direction = swarm_choose_direction(swarm, snake);
+        snake->target = swarm_step(swarm, snake->body[snake->head], snake->direction);
+        if (snake->target == SWARM_WALL) {
+            snake->fate = SWARM_DIE;
+            continue;
+        }
+        snake->fate = SWARM_PENDING;
+        worker->tile_start[swarm_tile(swarm, snake->target) + 1]++;
+    }
+    
+    for (int tile = 0; tile < swarm->tile_count; tile++) {
+        worker->tile_start[tile + 1] += worker->tile_start[tile];
+    }
+    memcpy(worker->tile_fill, worker->tile_start, swarm->tile_count * sizeof(int));
+    for (int i = worker->first_snake; i < worker->end_snake; i++) {
+        SwarmSnake *snake = &swarm->snakes[i];
+        if (snake->alive && snake->fate == SWARM_PENDING) {
+            worker->intents[worker->tile_fill[swarm_tile(swarm, snake->target)]++] = i;
+        }
+    }
+}
+
+void swarm_resolve(SwarmWorker *worker) {
+    Swarm *swarm = worker->swarm;
+    
+    for (int tile = worker->first_tile; tile < worker->end_tile; tile++) {
+        for (int pass = 0; pass < 3; pass++) {
+            for (int w = 0; w < swarm->worker_count; w++) {
+                SwarmWorker *planner = &swarm->workers[w];
+                for (int k = planner->tile_start[tile]; k < planner->tile_start[tile + 1]; k++) {
+                    SwarmSnake *snake = &swarm->snakes[planner->intents[k]];
+                    unsigned int target = snake->target;
+                    Point p = cell_point(swarm->cfg, target);
+                    int local = (p.y & (SWARM_TILE_SIZE - 1)) * SWARM_TILE_SIZE + (p.x & (SWARM_TILE_SIZE - 1));
+                    if (pass == 0) {
+                        worker->claims[local]++;
+                    } else if (pass == 1) {
+                        int cell = swarm->grid[target];
+                        if (worker->claims[local] > 1 || cell == CELL_BODY || cell == CELL_HEAD) {
+                            snake->fate = SWARM_DIE;
+                        } else {
+                            snake->fate = cell == CELL_FOOD ? SWARM_EAT : SWARM_MOVE;
+                        }
+                    } else {
+                        worker->claims[local] = 0;
+                    }
+                }
+            }
+        }
+    }
+}
+
+void swarm_snake_reserve(SwarmSnake *snake) {
+    if (snake->length < snake->capacity) {
+        return;
+    }
+    int capacity = snake->capacity ? snake->capacity * 2 : SWARM_START_LENGTH + 1;
+    unsigned int* body = malloc(capacity * sizeof(unsigned int));
+    for (int i = 0; i < snake->length; i++) {
+        body[i] = snake->body[(snake->head + i) % snake->capacity];
+    }
+    free(snake->body);
+    snake->body = body;
+    snake->head = 0;
+    snake->capacity = capacity;
+}
+
+void swarm_set(SwarmWorker *worker, unsigned int cell, int value) {
+    worker->swarm->grid[cell] = (unsigned char)value;
+    if (!worker->swarm->track_changes) {
+        return;
+    }
+    if (worker->change_count == worker->change_cap) {
+        worker->change_cap = worker->change_cap ? worker->change_cap * 2 : 1024;
+        worker->changes = realloc(worker->changes, worker->change_cap * sizeof(unsigned int));
+    }
+    worker->changes[worker->change_count++] = cell;
+}
+
+void swarm_apply(SwarmWorker *worker) {
+    Swarm *swarm = worker->swarm;
+    
+    worker->change_count = 0;
+    for (int i = worker->first_snake; i < worker->end_snake; i++) {
+        SwarmSnake *snake = &swarm->snakes[i];
+        if (!snake->alive) {
+            continue;
+        }
+        if (snake->fate == SWARM_DIE) {
+            for (int k = 0; k < snake->length; k++) {
+                swarm_set(worker, snake->body[(snake->head + k) % snake->capacity], CELL_EMPTY);
+            }
+            snake->alive = 0;
+            worker->deaths++;
+            continue;
+        }
+        
+        swarm_set(worker, snake->body[snake->head], CELL_BODY);
+        if (snake->fate == SWARM_EAT) {
+            snake->grow++;
+            snake->score += POINTS_PER_FOOD;
+            worker->eaten++;
+        }
+        if (swarm->cfg->game_mode == MODE_GREEDY) {
+            snake->grow++;
+        }
+        if (snake->grow > 0) {
+            snake->grow--;
+            swarm_snake_reserve(snake);
+        } else {
+            snake->length--;
+            swarm_set(worker, snake->body[(snake->head + snake->length) % snake->capacity], CELL_EMPTY);
+        }
+        snake->head = (snake->head + snake->capacity - 1) % snake->capacity;
+        snake->body[snake->head] = snake->target;
+        snake->length++;
+        swarm_set(worker, snake->target, CELL_HEAD);
+        worker->moves++;
+    }
+}
+
+unsigned int swarm_random_empty(Swarm *swarm) {
+    Config* cfg = swarm->cfg;
+    unsigned int cell_count = (unsigned int)cfg->board_width * (unsigned int)cfg->board_height;
+    for (int attempt = 0; attempt < SWARM_SPAWN_ATTEMPTS; attempt++) {
+        unsigned int r = rng_next(&swarm->rng_state) % cell_count;
+        Point p = {(int)(r % (unsigned int)cfg->board_width), (int)(r / (unsigned int)cfg->board_width)};
+        unsigned int cell = (unsigned int)cell_index(cfg, p);
+        if (swarm->grid[cell] == CELL_EMPTY) {
+            return cell;
+        }
+    }
+    return SWARM_WALL;
+}
+
+void swarm_spawn(Swarm *swarm) {
+    long long eaten = 0, deaths = 0, moves = 0;
+    for (int w = 0; w < swarm->worker_count; w++) {
+        eaten += swarm->workers[w].eaten;
+        deaths += swarm->workers[w].deaths;
+        moves += swarm->workers[w].moves;
+    }
+    swarm->food_count -= (int)(eaten - swarm->eaten);
+    swarm->eaten = eaten;
+    swarm->deaths = deaths;
+    swarm->moves = moves;
+    
+    while (swarm->food_count < swarm->food_target) {
+        unsigned int cell = swarm_random_empty(swarm);
+        if (cell == SWARM_WALL) {
+            break;
+        }
+        swarm_set(&swarm->workers[0], cell, CELL_FOOD);
+        swarm->food_count++;
+    }
+    
+    for (int i = 0; i < swarm->snake_count; i++) {
+        SwarmSnake *snake = &swarm->snakes[i];
+        if (snake->alive) {
+            continue;
+        }
+        unsigned int cell = swarm_random_empty(swarm);
+        if (cell == SWARM_WALL) {
+            break;
+        }
+        swarm_snake_reserve(snake);
+        snake->head = 0;
+        snake->length = 1;
+        snake->body[0] = cell;
+        snake->grow = SWARM_START_LENGTH - 1;
+        snake->direction = (int)(rng_next(&swarm->rng_state) % 4) + 1;
+        snake->score = 0;
+        snake->alive = 1;
+        swarm_set(&swarm->workers[0], cell, CELL_HEAD);
+    }
+}
+
+void swarm_run_phases(SwarmWorker *worker) {
+    Swarm *swarm = worker->swarm;
+    swarm_plan(worker);
+    pthread_barrier_wait(&swarm->barrier);
+    swarm_resolve(worker);
+    pthread_barrier_wait(&swarm->barrier);
+    swarm_apply(worker);
+    pthread_barrier_wait(&swarm->barrier);
+}
+
+void* swarm_worker(void* arg) {
+    SwarmWorker *worker = arg;
+    Swarm *swarm = worker->swarm;
+    
+    pin_thread(worker->cpu);
+    while (1) {
+        pthread_barrier_wait(&swarm->barrier);
+        if (swarm->stopping) {
+            break;
+        }
+        swarm_run_phases(worker);
+    }
+    return NULL;
+}
+
+void swarm_tick(Swarm *swarm) {
+    pthread_barrier_wait(&swarm->barrier);
+    swarm_run_phases(&swarm->workers[0]);
+    swarm_spawn(swarm);
+    swarm->ticks++;
+}
+
+int swarm_init(Swarm *swarm, Config* cfg, int snake_count) {
+    memset(swarm, 0, sizeof(*swarm));
+    swarm->cfg = cfg;
+    swarm->snake_count = snake_count;
+    swarm->food_target = snake_count;
+    seed_game_state(&swarm->rng_state, game_seed);
+    
+    unsigned long long cell_count = board_cells(cfg);
+    if (cell_count >= SWARM_WALL) {
+        printf("Error: Board of %dx%d cells is too large for a swarm\n", cfg->board_width, cfg->board_height);
+        return 1;
+    }
+    if ((unsigned long long)snake_count * SWARM_START_LENGTH * 2 > (unsigned long long)cfg->board_width * cfg->board_height) {
+        printf("Error: A %dx%d board is too small for %d snakes\n", cfg->board_width, cfg->board_height, snake_count);
+        return 1;
+    }
+    
+    swarm->tiles_x = (cfg->board_width + SWARM_TILE_SIZE - 1) >> SWARM_TILE_BITS;
+    swarm->tiles_y = (cfg->board_height + SWARM_TILE_SIZE - 1) >> SWARM_TILE_BITS;
+    swarm->tile_count = swarm->tiles_x * swarm->tiles_y;
+    swarm->grid = board_alloc(cell_count);
+    swarm->snakes = calloc(snake_count, sizeof(SwarmSnake));
+    swarm->worker_count = thread_count();
+    swarm->workers = aligned_alloc(64, swarm->worker_count * sizeof(SwarmWorker));
+    if (!swarm->grid || !swarm->snakes || !swarm->workers) {
+        printf("Error: Not enough memory for a %dx%d swarm board\n", cfg->board_width, cfg->board_height);
+        return 1;
+    }
+    memset(swarm->workers, 0, swarm->worker_count * sizeof(SwarmWorker));
+    
+    for (int i = 0; i < snake_count; i++) {
+        seed_game_state(&swarm->snakes[i].rng_state, game_seed + (unsigned long long)(i + 1) * 0x9E3779B97F4A7C15ULL);
+    }
+    
+    int cpus[CPU_SETSIZE];
+    int cpu_count = allowed_cpus(cpus);
+    int failed = 0;
+    for (int w = 0; w < swarm->worker_count; w++) {
+        SwarmWorker *worker = &swarm->workers[w];
+        worker->swarm = swarm;
+        worker->index = w;
+        worker->cpu = cpu_count > 0 ? cpus[w % cpu_count] : -1;
+        worker->first_snake = (int)((long long)snake_count * w / swarm->worker_count);
+        worker->end_snake = (int)((long long)snake_count * (w + 1) / swarm->worker_count);
+        worker->first_tile = (int)((long long)swarm->tile_count * w / swarm->worker_count);
+        worker->end_tile = (int)((long long)swarm->tile_count * (w + 1) / swarm->worker_count);
+        worker->tile_start = malloc((swarm->tile_count + 1) * sizeof(int));
+        worker->tile_fill = malloc(swarm->tile_count * sizeof(int));
+        worker->intents = malloc((worker->end_snake - worker->first_snake + 1) * sizeof(int));
+        worker->claims = calloc(SWARM_TILE_SIZE * SWARM_TILE_SIZE, sizeof(unsigned short));
+        failed |= !worker->tile_start || !worker->tile_fill || !worker->intents || !worker->claims;
+    }
+    if (failed) {
+        printf("Error: Not enough memory for %d swarm workers\n", swarm->worker_count);
+        return 1;
+    }
+    
+    swarm_spawn(swarm);
+    return 0;
+}
+
+void swarm_start(Swarm *swarm) {
+    pthread_barrier_init(&swarm->barrier, NULL, swarm->worker_count);
+    for (int w = 1; w < swarm->worker_count; w++) {
+        pthread_create(&swarm->workers[w].thread, NULL, swarm_worker, &swarm->workers[w]);
+    }
+}
+
+void swarm_stop(Swarm *swarm) {
+    swarm->stopping = 1;
+    pthread_barrier_wait(&swarm->barrier);
+    for (int w = 1; w < swarm->worker_count; w++) {
+        pthread_join(swarm->workers[w].thread, NULL);
+    }
+    pthread_barrier_destroy(&swarm->barrier);
+}
+
+void swarm_free(Swarm *swarm) {
+    for (int w = 0; swarm->workers && w < swarm->worker_count; w++) {
+        free(swarm->workers[w].tile_start);
+        free(swarm->workers[w].tile_fill);
+        free(swarm->workers[w].intents);
+        free(swarm->workers[w].claims);
+        free(swarm->workers[w].changes);
+    }
+    for (int i = 0; swarm->snakes && i < swarm->snake_count; i++) {
+        free(swarm->snakes[i].body);
+    }
+    free(swarm->workers);
+    free(swarm->snakes);
+    board_free(swarm->grid);
+    memset(swarm, 0, sizeof(*swarm));
+}
+
+int run_swarm(Config* cfg, int snake_count) {
+    Swarm swarm;
+    if (swarm_init(&swarm, cfg, snake_count) != 0) {
+        swarm_free(&swarm);
+        return 1;
+    }
+    printf("Swarm: %d snakes on %dx%d (%d tiles) with %d threads, seed %llu\n", snake_count,
+           cfg->board_width, cfg->board_height, swarm.tile_count, swarm.worker_count, game_seed);
+    printf("Board memory: %zu MB in %s, %s layout\n", (board_cells(cfg) + (1 << 20) - 1) >> 20,
+           board_memory_name(swarm.grid), BOARD_LAYOUT_NAME);
+    fflush(stdout);
+    
+    pin_thread(swarm.workers[0].cpu);
+    swarm_start(&swarm);
+    long long started = monotonic_us();
+    for (long long tick = 0; tick < swarm_ticks; tick++) {
+        swarm_tick(&swarm);
+    }
+    long long elapsed = monotonic_us() - started;
+    swarm_stop(&swarm);
+    
+    int alive = 0;
+    int longest = 0;
+    int best_score = 0;
+    unsigned long long checksum = batch_game_hash(swarm.ticks, (int)swarm.eaten, swarm.deaths);
+    for (int i = 0; i < snake_count; i++) {
+        SwarmSnake *snake = &swarm.snakes[i];
+        if (!snake->alive) {
+            checksum = checksum * 0x100000001B3ULL ^ batch_game_hash(i, -1, 0);
+            continue;
+        }
+        alive++;
+        if (snake->length > longest) {
+            longest = snake->length;
+        }
+        if (snake->score > best_score) {
+            best_score = snake->score;
+        }
+        Point head = cell_point(cfg, snake->body[snake->head]);
+        checksum = checksum * 0x100000001B3ULL ^
+                   batch_game_hash(i, snake->score, (long long)snake->length << 32 |
+                                   ((unsigned long long)head.y * cfg->board_width + head.x));
+    }
+    
+    printf("Finished in %lld ms: %lld ticks (%lld ticks/s, %lld moves/s)\n", elapsed / 1000, swarm.ticks,
+           elapsed > 0 ? swarm.ticks * MICROSECONDS_PER_SECOND / elapsed : 0,
+           elapsed > 0 ? swarm.moves * MICROSECONDS_PER_SECOND / elapsed : 0);
+    printf("Snakes: %d alive, %lld deaths, %lld food eaten, longest %d, best score %d\n",
+           alive, swarm.deaths, swarm.eaten, longest, best_score);
+    printf("Checksum: %016llx\n", checksum);
+    
+    swarm_free(&swarm);
+    return 0;
+}
+
+void timer_wheel_init(TimerWheel *wheel, long long now_us) {
+    for (int level = 0; level < TIMER_WHEEL_LEVELS; level++) {
+        for (int slot = 0; slot < TIMER_WHEEL_SLOTS; slot++) {
+            Timer* head = &wheel->slots[level][slot];
+            head->next = head;
+            head->prev = head;
+        }
+        wheel->occupied[level] = 0;
+    }
+    wheel->current = now_us / TIMER_WHEEL_RESOLUTION_US;
+    wheel->count = 0;
+}
+
+void timer_wheel_link(TimerWheel *wheel, Timer *timer, long long earliest) {
+    long long tick = timer->expires;
+    long long delta = tick - wheel->current;
+    int level = 0;
+    
+    if (tick <= earliest) {
+        tick = earliest;
+    } else {
+        while (level < TIMER_WHEEL_LEVELS - 1 && delta >= (1LL << (TIMER_WHEEL_BITS * (level + 1)))) {
+            level++;
+        }
+        long long horizon = 1LL << (TIMER_WHEEL_BITS * TIMER_WHEEL_LEVELS);
+        if (delta >= horizon) {
+            tick = wheel->current + horizon - 1;
+        }
+    }
+    
+    int slot = (int)((tick >> (TIMER_WHEEL_BITS * level)) & (TIMER_WHEEL_SLOTS - 1));
+    Timer* head = &wheel->slots[level][slot];
+    timer->level = level;
+    timer->slot = slot;
+    timer->next = head;
+    timer->prev = head->prev;
+    head->prev->next = timer;
+    head->prev = timer;
+    wheel->occupied[level] |= 1ULL << slot;
+}
+
+void timer_wheel_add(TimerWheel *wheel, Timer *timer, long long expires_us) {
+    timer->expires = (expires_us + TIMER_WHEEL_RESOLUTION_US - 1) / TIMER_WHEEL_RESOLUTION_US;
+    timer_wheel_link(wheel, timer, wheel->current + 1);
+    wheel->count++;
+}
+
+void timer_wheel_cancel(TimerWheel *wheel, Timer *timer) {
+    if (!timer->next) {
+        return;
+    }
+    timer->prev->next = timer->next;
+    timer->next->prev = timer->prev;
+    Timer* head = &wheel->slots[timer->level][timer->slot];
+    if (head->next == head) {
+        wheel->occupied[timer->level] &= ~(1ULL << timer->slot);
+    }
+    timer->next = NULL;
+    timer->prev = NULL;
+    wheel->count--;
+}
+
+void timer_wheel_cascade(TimerWheel *wheel, int level, int slot) {
+    Timer* head = &wheel->slots[level][slot];
+    Timer* timer = head->next;
+    head->next = head;
+    head->prev = head;
+    wheel->occupied[level] &= ~(1ULL << slot);
+    
+    while (timer != head) {
+        Timer* next = timer->next;
+        timer_wheel_link(wheel, timer, wheel->current);
+        timer = next;
+    }
+}
+
+void timer_wheel_advance(TimerWheel *wheel, long long now_us, void (*fire)(void*, Timer*), void* context) {
+    long long target = now_us / TIMER_WHEEL_RESOLUTION_US;
+    
+    while (wheel->current < target) {
+        long long tick = wheel->current + 1;
+        wheel->current = tick;
+        for (int level = 1; level < TIMER_WHEEL_LEVELS; level++) {
+            if ((tick & ((1LL << (TIMER_WHEEL_BITS * level)) - 1)) != 0) {
+                break;
+            }
+            timer_wheel_cascade(wheel, level, (int)((tick >> (TIMER_WHEEL_BITS * level)) & (TIMER_WHEEL_SLOTS - 1)));
+        }
+        
+        int slot = (int)(tick & (TIMER_WHEEL_SLOTS - 1));
+        if (wheel->occupied[0] & (1ULL << slot)) {
+            Timer* head = &wheel->slots[0][slot];
+            Timer expired = {0};
+            expired.next = head->next;
+            expired.prev = head->prev;
+            expired.next->prev = &expired;
+            expired.prev->next = &expired;
+            head->next = head;
+            head->prev = head;
+            wheel->occupied[0] &= ~(1ULL << slot);
+            
+            while (expired.next != &expired) {
+                Timer* timer = expired.next;
+                expired.next = timer->next;
+                timer->next->prev = &expired;
+                timer->next = NULL;
+                timer->prev = NULL;
+                wheel->count--;
+                fire(context, timer);
+            }
+        }
+        
+        if (wheel->occupied[0] == 0) {
+            long long boundary = (tick | (TIMER_WHEEL_SLOTS - 1));
+            wheel->current = boundary < target ? boundary : target;
+        }
+    }
+}
+
+long long timer_wheel_next(TimerWheel *wheel) {
+    if (wheel->count == 0) {
+        return -1;
+    }
+    
+    long long next = -1;
+    for (int level = 0; level < TIMER_WHEEL_LEVELS; level++) {
+        unsigned long long bits = wheel->occupied[level];
+        if (!bits) {
+            continue;
+        }
+        int shift = TIMER_WHEEL_BITS * level;
+        long long base = (wheel->current >> shift) + 1;
+        int start = (int)(base & (TIMER_WHEEL_SLOTS - 1));
+        unsigned long long rotated = (bits >> start) | (start ? bits << (TIMER_WHEEL_SLOTS - start) : 0);
+        long long tick = (base + __builtin_ctzll(rotated)) << shift;
+        if (next < 0 || tick < next) {
+            next = tick;
+        }
+    }
+    return next * TIMER_WHEEL_RESOLUTION_US;
+}
+
+void handle_server_signal(int sig) {
+    (void)sig;
+    server_stop = 1;
+}
+
+int server_listen(const char* address) {
+    int fd;
+    int is_port = address[0] != '\0' && strspn(address, "0123456789") == strlen(address);
+    
+    if (is_port) {
+        struct sockaddr_in addr = {0};
+        addr.sin_family = AF_INET;
+        addr.sin_port = htons((unsigned short)atoi(address));
+        addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+        fd = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+        if (fd < 0) {
+            printf("Error: Cannot create a socket: %s\n", strerror(errno));
+            return -1;
+        }
+        int one = 1;
+        setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+        if (bind(fd, (struct sockaddr*)&addr, sizeof(addr)) != 0) {
+            printf("Error: Cannot listen on localhost port %s: %s\n", address, strerror(errno));
+            close(fd);
+            return -1;
+        }
+    } else {
+        struct sockaddr_un addr = {0};
+        addr.sun_family = AF_UNIX;
+        if (strlen(address) >= sizeof(addr.sun_path)) {
+            printf("Error: Socket path '%s' is too long\n", address);
+            return -1;
+        }
+        strcpy(addr.sun_path, address);
+        unlink(address);
+        fd = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+        if (fd < 0) {
+            printf("Error: Cannot create a socket: %s\n", strerror(errno));
+            return -1;
+        }
+        if (bind(fd, (struct sockaddr*)&addr, sizeof(addr)) != 0) {
+            printf("Error: Cannot listen on '%s': %s\n", address, strerror(errno));
+            close(fd);
+            return -1;
+        }
+    }
+    
+    if (listen(fd, SOMAXCONN) != 0) {
+        printf("Error: listen failed: %s\n", strerror(errno));
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+void session_update_events(Server *server, Session *session) {
+    struct epoll_event ev = {0};
+    ev.events = EPOLLIN | EPOLLRDHUP | (session->want_write ? EPOLLOUT : 0);
+    ev.data.ptr = session;
+    epoll_ctl(server->epoll_fd, EPOLL_CTL_MOD, session->fd, &ev);
+}
+
+void server_mark_dirty(Server *server, Session *session) {
+    if (!session->dirty) {
+        session->dirty = 1;
+        session->dirty_next = server->dirty_head;
+        server->dirty_head = session;
+    }
+}
+
+int compare_ints(const void* a, const void* b) {
+    int x = *(const int*)a;
+    int y = *(const int*)b;
+    return (x > y) - (x < y);
+}
+
+int compare_sizes(const void* a, const void* b) {
+    size_t x = *(const size_t*)a;
+    size_t y = *(const size_t*)b;
+    return (x > y) - (x < y);
+}
+
+void viewer_subscribe(Server *server, Session *session, int subscribe) {
+    Swarm *swarm = server->swarm;
+    int tx0 = session->view_x >> SWARM_TILE_BITS;
+    int tx1 = (session->view_x + server->view_width - 1) >> SWARM_TILE_BITS;
+    int ty0 = session->view_y >> SWARM_TILE_BITS;
+    int ty1 = (session->view_y + server->view_height - 1) >> SWARM_TILE_BITS;
+    
+    for (int ty = ty0; ty <= ty1; ty++) {
+        for (int tx = tx0; tx <= tx1; tx++) {
+            TileSubscribers *subs = &server->subscribers[ty * swarm->tiles_x + tx];
+            if (subscribe) {
+                if (subs->count == subs->cap) {
+                    subs->cap = subs->cap ? subs->cap * 2 : 4;
+                    subs->sessions = realloc(subs->sessions, subs->cap * sizeof(Session*));
+                }
+                subs->sessions[subs->count++] = session;
+                continue;
+            }
+            for (int i = 0; i < subs->count; i++) {
+                if (subs->sessions[i] == session) {
+                    subs->sessions[i] = subs->sessions[--subs->count];
+                    break;
+                }
+            }
+        }
+    }
+}
+
+int viewer_init(Server *server, Session *session) {
+    size_t cells = (size_t)server->view_width * server->view_height;
+    if (renderer_init_size(&session->renderer, server->cfg, server->view_width, server->view_height) != 0) {
+        return -1;
+    }
+    session->view_pending = malloc(cells * sizeof(size_t));
+    session->view_marked = calloc(cells, 1);
+    if (!session->view_pending || !session->view_marked) {
+        free(session->view_pending);
+        free(session->view_marked);
+        session->view_pending = NULL;
+        session->view_marked = NULL;
+        renderer_free(&session->renderer);
+        return -1;
+    }
+    session->view_x = (server->cfg->board_width - server->view_width) / 2;
+    session->view_y = (server->cfg->board_height - server->view_height) / 2;
+    viewer_subscribe(server, session, 1);
+    return 0;
+}
+
+void viewer_free(Server *server, Session *session) {
+    viewer_subscribe(server, session, 0);
+    free(session->view_pending);
+    free(session->view_marked);
+    session->view_pending = NULL;
+    session->view_marked = NULL;
+}
+
+void viewer_pan(Server *server, Session *session, int dx, int dy) {
+    int x = session->view_x + dx;
+    int y = session->view_y + dy;
+    int max_x = server->cfg->board_width - server->view_width;
+    int max_y = server->cfg->board_height - server->view_height;
+    x = x < 0 ? 0 : x > max_x ? max_x : x;
+    y = y < 0 ? 0 : y > max_y ? max_y : y;
+    if (x == session->view_x && y == session->view_y) {
+        return;
+    }
+    
+    viewer_subscribe(server, session, 0);
+    session->view_x = x;
+    session->view_y = y;
+    viewer_subscribe(server, session, 1);
+    session->renderer.has_frame = 0;
+}
+
+void server_swarm_tick(Server *server) {
+    Swarm *swarm = server->swarm;
+    swarm_tick(swarm);
+    for (int w = 0; w < swarm->worker_count; w++) {
+        SwarmWorker *worker = &swarm->workers[w];
+        for (int k = 0; k < worker->change_count; k++) {
+            unsigned int cell = worker->changes[k];
+            TileSubscribers *subs = &server->subscribers[swarm_tile(swarm, cell)];
+            if (subs->count == 0) {
+                continue;
+            }
+            Point p = cell_point(server->cfg, cell);
+            for (int i = 0; i < subs->count; i++) {
+                Session *session = subs->sessions[i];
+                int vx = p.x - session->view_x;
+                int vy = p.y - session->view_y;
+                if (vx < 0 || vy < 0 || vx >= server->view_width || vy >= server->view_height) {
+                    continue;
+                }
+                size_t local = (size_t)vy * server->view_width + vx;
+                if (!session->view_marked[local]) {
+                    session->view_marked[local] = 1;
+                    session->view_pending[session->view_pending_count++] = local;
+                }
+            }
+        }
+    }
+}
+
+unsigned char viewer_cell(Server *server, Session *session, int x, int y) {
+    Point p = {session->view_x + x, session->view_y + y};
+    return server->swarm->grid[cell_index(server->cfg, p)];
+}
+
+void viewer_render_full(Server *server, Session *session, OutBuf *out) {
+    Config* cfg = server->cfg;
+    Renderer *r = &session->renderer;
+    
+    for (int y = 0; y < r->height; y++) {
+        for (int x = 0; x < r->width; x++) {
+            r->cells[(size_t)y * r->width + x] = viewer_cell(server, session, x, y);
+        }
+    }
+    outbuf_printf(out, "\033[2J\033[HView %d,%d of a %dx%d board with %d snakes\r\n\r\n", session->view_x,
+                  session->view_y, cfg->board_width, cfg->board_height, server->swarm->snake_count);
+    render_rows(cfg, r->cells, r->width, r->height, "\r\n", out);
+    outbuf_puts(out, "\r\n" VIEW_HELP_LINE "\r\n");
+    
+    for (size_t k = 0; k < session->view_pending_count; k++) {
+        session->view_marked[session->view_pending[k]] = 0;
+    }
+    session->view_pending_count = 0;
+    r->cursor_row = r->height + 7;
+    r->cursor_col = 1;
+    r->has_frame = 1;
+}
+
+void viewer_render_changes(Server *server, Session *session, OutBuf *out) {
+    Renderer *r = &session->renderer;
+    int cell_width = server->cfg->emoji_mode ? 2 : 1;
+    char seq[32];
+    
+    qsort(session->view_pending, session->view_pending_count, sizeof(size_t), compare_sizes);
+    for (size_t k = 0; k < session->view_pending_count; k++) {
+        size_t local = session->view_pending[k];
+        int x = (int)(local % r->width);
+        int y = (int)(local / r->width);
+        session->view_marked[local] = 0;
+        unsigned char cell = viewer_cell(server, session, x, y);
+        if (cell == r->cells[local]) {
+            continue;
+        }
+        
+        r->cells[local] = cell;
+        int row = y + 4;
+        int col = (x + 1) * cell_width + 1;
+        outbuf_write(out, seq, cursor_move(r, seq, row, col));
+        outbuf_puts(out, cell_glyph(cell, server->cfg->emoji_mode));
+        r->cursor_row = row;
+        r->cursor_col = col + cell_width;
+        server->view_changes++;
+    }
+    session->view_pending_count = 0;
+}
+
+void viewer_update(Server *server, Session *session) {
+    Command command;
+    int step_x = server->view_width / 2;
+    int step_y = server->view_height / 2;
+    
+    while (command_queue_pop(&session->commands, &command)) {
+        session->commands_applied++;
+        session->command_wait_us += server->now - command.time_us;
+        switch (command.key) {
+            case 'w':
+            case 'W':
+                viewer_pan(server, session, 0, -step_y);
+                break;
+            case 's':
+            case 'S':
+                viewer_pan(server, session, 0, step_y);
+                break;
+            case 'a':
+            case 'A':
+                viewer_pan(server, session, -step_x, 0);
+                break;
+            case 'd':
+            case 'D':
+                viewer_pan(server, session, step_x, 0);
+                break;
+            case 'q':
+            case 'Q':
+                session->closing = 1;
+                outbuf_puts(&session->out, "\033[2J\033[H\033[?25hStopped viewing\r\n");
+                return;
+        }
+    }
+    
+    if (session->out.len - session->out_sent >= SESSION_MAX_PENDING) {
+        return;
+    }
+    Renderer *r = &session->renderer;
+    size_t start = session->out.len;
+    if (!r->has_frame) {
+        viewer_render_full(server, session, &session->out);
+    } else {
+        viewer_render_changes(server, session, &session->out);
+    }
+    r->frames++;
+    r->bytes += (long long)(session->out.len - start);
+}
+
+void session_close(Server *server, Session *session) {
+    if (server->epoll_fd >= 0) {
+        epoll_ctl(server->epoll_fd, EPOLL_CTL_DEL, session->fd, NULL);
+    }
+    close(session->fd);
+    timer_wheel_cancel(&server->timers, &session->move_timer);
+    timer_wheel_cancel(&server->timers, &session->render_timer);
+    
+    server->bytes_sent += session->bytes_sent;
+    server->commands_applied += session->commands_applied;
+    server->command_wait_us += session->command_wait_us;
+    server->command_drops += session->commands.drops;
+    if (session->commands.max_depth > server->command_max_depth) {
+        server->command_max_depth = session->commands.max_depth;
+    }
+    server->session_us += monotonic_us() - session->started;
+    
+    Session *last = server->sessions[--server->session_count];
+    server->sessions[session->index] = last;
+    last->index = session->index;
+    
+    if (server->swarm) {
+        viewer_free(server, session);
+    }
+    renderer_free(&session->renderer);
+    outbuf_free(&session->out);
+    cleanup_game(&session->game);
+    free(session);
+}
+
+int session_flush(Server *server, Session *session) {
+    while (session->out_sent < session->out.len) {
+        ssize_t n = send(session->fd, session->out.data + session->out_sent,
+                         session->out.len - session->out_sent, MSG_NOSIGNAL);
+        if (n > 0) {
+            session->out_sent += (size_t)n;
+            session->bytes_sent += n;
+        } else if (n < 0 && errno == EINTR) {
+            continue;
+        } else if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+            if (!session->want_write) {
+                session->want_write = 1;
+                session_update_events(server, session);
+            }
+            return 0;
+        } else {
+            return -1;
+        }
+    }
+    
+    session->out.len = 0;
+    session->out_sent = 0;
+    if (session->want_write) {
+        session->want_write = 0;
+        session_update_events(server, session);
+    }
+    return session->closing ? -1 : 0;
+}
+
+void session_finish(Session *session) {
+    session->closing = 1;
+    outbuf_printf(&session->out, "\033[2J\033[H\033[?25hGame Over! Final Score: %d\r\n", session->game.score);
+}
+
+Session* server_add_session(Server *server, int fd) {
+    if (server->session_count == server->session_cap) {
+        int cap = server->session_cap ? server->session_cap * 2 : 64;
+        Session** sessions = realloc(server->sessions, cap * sizeof(Session*));
+        if (!sessions) {
+            return NULL;
+        }
+        server->sessions = sessions;
+        server->session_cap = cap;
+    }
+    Session *session = calloc(1, sizeof(Session));
+    if (!session) {
+        return NULL;
+    }
+    session->fd = fd;
+    outbuf_reserve(&session->out, 1);
+    if (!session->out.data) {
+        free(session);
+        return NULL;
+    }
+    if (server->swarm) {
+        if (viewer_init(server, session) != 0) {
+            free(session->out.data);
+            free(session);
+            return NULL;
+        }
+    } else if (init_game(&session->game, server->cfg,
+                         server->seed + (unsigned long long)server->sessions_served * 0x9E3779B97F4A7C15ULL) != 0 ||
+               renderer_init(&session->renderer, server->cfg) != 0) {
+        printf("Error: Not enough memory for a %dx%d board\n", server->cfg->board_width, server->cfg->board_height);
+        cleanup_game(&session->game);
+        free(session->out.data);
+        free(session);
+        return NULL;
+    }
+    session->renderer.newline = "\r\n";
+    session->started = monotonic_us();
+    command_queue_init(&session->commands);
+    outbuf_puts(&session->out, "\033[?25l");
+    
+    session->move_timer.owner = session;
+    session->move_timer.kind = TIMER_MOVE;
+    session->render_timer.owner = session;
+    session->render_timer.kind = TIMER_RENDER;
+    if (!server->swarm) {
+        timer_wheel_add(&server->timers, &session->move_timer, session->started + server->cfg->move_interval);
+    }
+    timer_wheel_add(&server->timers, &session->render_timer, session->started);
+    server_mark_dirty(server, session);
+    
+    session->index = server->session_count;
+    server->sessions[server->session_count++] = session;
+    server->sessions_served++;
+    return session;
+}
+
+int accept_exhausted(int err) {
+    return err == EMFILE || err == ENFILE || err == ENOBUFS || err == ENOMEM;
+}
+
+void server_pause_accept(Server *server) {
+    server->accept_timer.owner = server;
+    server->accept_timer.kind = TIMER_ACCEPT;
+    timer_wheel_add(&server->timers, &server->accept_timer, monotonic_us() + SERVER_ACCEPT_BACKOFF_US);
+}
+
+void server_watch_listen(Server *server, int op) {
+    struct epoll_event ev = {0};
+    ev.events = EPOLLIN;
+    ev.data.ptr = NULL;
+    epoll_ctl(server->epoll_fd, op, server->listen_fd, &ev);
+}
+
+void server_accept(Server *server) {
+    while (1) {
+        int fd = accept4(server->listen_fd, NULL, NULL, SOCK_NONBLOCK | SOCK_CLOEXEC);
+        if (fd < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            if (accept_exhausted(errno)) {
+                server_watch_listen(server, EPOLL_CTL_DEL);
+                server_pause_accept(server);
+            }
+            return;
+        }
+        
+        Session *session = server_add_session(server, fd);
+        if (!session) {
+            close(fd);
+            continue;
+        }
+        struct epoll_event ev = {0};
+        ev.events = EPOLLIN | EPOLLRDHUP;
+        ev.data.ptr = session;
+        epoll_ctl(server->epoll_fd, EPOLL_CTL_ADD, fd, &ev);
+    }
+}
+
+void session_input(Server *server, Session *session, const unsigned char* buf, ssize_t len) {
+    long long now = monotonic_us();
+    for (ssize_t i = 0; i < len; i++) {
+        int key = decode_key(&session->keys, buf[i]);
+        if (!key || !strchr(COMMAND_KEYS, key)) {
+            continue;
+        }
+        if (!server->swarm && strchr(CONTROL_KEYS, key)) {
+            if (!session->game.game_over) {
+                apply_key(&session->game, key);
+                session->commands_applied++;
+            }
+        } else {
+            command_queue_push(&session->commands, key, now);
+        }
+    }
+}
+
+void session_apply_commands(Session *session, long long now) {
+    session->commands_applied += command_queue_apply(&session->commands, &session->game, now,
+                                                     &session->command_wait_us);
+}
+
+int session_read(Server *server, Session *session) {
+    while (1) {
+        ssize_t n = recv(session->fd, session->in_buf, sizeof(session->in_buf), 0);
+        if (n > 0) {
+            session_input(server, session, session->in_buf, n);
+        } else if (n < 0 && errno == EINTR) {
+            continue;
+        } else if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+            return 0;
+        } else {
+            return -1;
+        }
+    }
+}
+
+void session_timer_fired(void* context, Timer *timer) {
+    Server *server = context;
+    Config* cfg = server->cfg;
+    
+    if (timer->kind == TIMER_ACCEPT) {
+        server->accept_resume = 1;
+        return;
+    }
+    if (timer->kind == TIMER_SWARM) {
+        server_swarm_tick(server);
+        timer_wheel_add(&server->timers, timer, server->now + cfg->move_interval);
+        return;
+    }
+    
+    Session *session = timer->owner;
+    Game *game = &session->game;
+    if (session->closing) {
+        return;
+    }
+    
+    if (timer->kind == TIMER_MOVE) {
+        session_apply_commands(session, server->now);
+        if (game->paused && !game->game_over) {
+            return;
+        }
+        if (!game->game_over) {
+            move_snake(game, cfg);
+        }
+        timer_wheel_add(&server->timers, timer, server->now + cfg->move_interval);
+        return;
+    }
+    
+    if (!session->send_inflight) {
+        if (server->swarm) {
+            viewer_update(server, session);
+            server_mark_dirty(server, session);
+        } else if (game->game_over) {
+            session_finish(session);
+            server_mark_dirty(server, session);
+            return;
+        } else if (session->out.len - session->out_sent < SESSION_MAX_PENDING) {
+            fill_cells(game, cfg, server->cells);
+            render_frame(&session->renderer, game, cfg, server->cells, &session->out);
+            server_mark_dirty(server, session);
+        }
+    }
+    if (!server->swarm && game->paused && !session->send_inflight && session->renderer.paused &&
+        session->move_timer.next == NULL) {
+        return;
+    }
+    timer_wheel_add(&server->timers, timer, server->now + cfg->render_interval);
+}
+
+void session_wake(Server *server, Session *session) {
+    if (server->swarm || session->closing || session->move_timer.next) {
+        return;
+    }
+    session_apply_commands(session, server->now);
+    if (!session->game.paused || session->game.game_over) {
+        timer_wheel_add(&server->timers, &session->move_timer, server->now + server->cfg->move_interval);
+    }
+    if (!session->render_timer.next) {
+        timer_wheel_add(&server->timers, &session->render_timer, server->now);
+    }
+}
+
+void session_drop(Session *session) {
+    session->closing = 1;
+    session->out.len = 0;
+    session->out_sent = 0;
+}
+
+int server_timeout_us(Server *server) {
+    long long next = timer_wheel_next(&server->timers);
+    if (next < 0) {
+        return -1;
+    }
+    return next > server->now ? (int)(next - server->now) : 0;
+}
+
+int run_server_epoll(Server *server) {
+    server->epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+    if (server->epoll_fd < 0) {
+        printf("Error: epoll_create1 failed: %s\n", strerror(errno));
+        return 1;
+    }
+    server_watch_listen(server, EPOLL_CTL_ADD);
+    
+    struct epoll_event events[SERVER_MAX_EVENTS];
+    int timeout_ms = -1;
+    int failed = 0;
+    
+    while (!server_stop) {
+        int count = epoll_wait(server->epoll_fd, events, SERVER_MAX_EVENTS, timeout_ms);
+        if (count < 0 && errno != EINTR) {
+            printf("Error: epoll_wait failed: %s\n", strerror(errno));
+            failed = 1;
+            break;
+        }
+        
+        for (int i = 0; i < count; i++) {
+            Session *session = events[i].data.ptr;
+            if (!session) {
+                server_accept(server);
+                continue;
+            }
+            if ((events[i].events & EPOLLIN) && session_read(server, session) != 0) {
+                session_drop(session);
+            } else if (events[i].events & (EPOLLERR | EPOLLHUP)) {
+                session_drop(session);
+            } else if ((events[i].events & EPOLLOUT) && session_flush(server, session) != 0) {
+                session_drop(session);
+            }
+            if (events[i].events & EPOLLIN) {
+                session_wake(server, session);
+            }
+            server_mark_dirty(server, session);
+        }
+        
+        server->now = monotonic_us();
+        timer_wheel_advance(&server->timers, server->now, session_timer_fired, server);
+        if (server->accept_resume) {
+            server->accept_resume = 0;
+            server_watch_listen(server, EPOLL_CTL_ADD);
+        }
+        
+        Session *session = server->dirty_head;
+        server->dirty_head = NULL;
+        while (session) {
+            Session *next = session->dirty_next;
+            session->dirty = 0;
+            if (!session->want_write && session_flush(server, session) != 0) {
+                session_drop(session);
+            }
+            if (session->closing && (session->out.len == 0 || !session->want_write)) {
+                session_close(server, session);
+            }
+            session = next;
+        }
+        
+        int timeout_us = server_timeout_us(server);
+        timeout_ms = timeout_us < 0 ? -1 : (timeout_us + 999) / 1000;
+    }
+    
+    while (server->session_count > 0) {
+        session_close(server, server->sessions[server->session_count - 1]);
+    }
+    close(server->epoll_fd);
+    return failed;
+}
+
+int uring_init(Uring *ring, unsigned entries) {
+    struct io_uring_params params = {0};
+    params.flags = IORING_SETUP_CQSIZE;
+    params.cq_entries = entries * 4;
+    
+    memset(ring, 0, sizeof(*ring));
+    ring->fd = (int)syscall(__NR_io_uring_setup, entries, &params);
+    if (ring->fd < 0) {
+        return -1;
+    }
+    if (!(params.features & IORING_FEAT_EXT_ARG)) {
+        close(ring->fd);
+        return -1;
+    }
+    
+    ring->sq_ring_size = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+    ring->cq_ring_size = params.cq_off.cqes + params.cq_entries * sizeof(struct io_uring_cqe);
+    if (params.features & IORING_FEAT_SINGLE_MMAP) {
+        if (ring->cq_ring_size > ring->sq_ring_size) {
+            ring->sq_ring_size = ring->cq_ring_size;
+        }
+        ring->cq_ring_size = 0;
+    }
+    ring->sq_ring = mmap(NULL, ring->sq_ring_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+                         ring->fd, IORING_OFF_SQ_RING);
+    ring->cq_ring = ring->sq_ring;
+    if (ring->sq_ring != MAP_FAILED && ring->cq_ring_size > 0) {
+        ring->cq_ring = mmap(NULL, ring->cq_ring_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+                             ring->fd, IORING_OFF_CQ_RING);
+    }
+    ring->sqes_size = params.sq_entries * sizeof(struct io_uring_sqe);
+    ring->sqes = mmap(NULL, ring->sqes_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+                      ring->fd, IORING_OFF_SQES);
+    if (ring->sq_ring == MAP_FAILED || ring->cq_ring == MAP_FAILED || ring->sqes == MAP_FAILED) {
+        close(ring->fd);
+        return -1;
+    }
+    
+    char* sq = ring->sq_ring;
+    char* cq = ring->cq_ring;
+    ring->sq_head = (unsigned*)(sq + params.sq_off.head);
+    ring->sq_tail = (unsigned*)(sq + params.sq_off.tail);
+    ring->sq_mask = (unsigned*)(sq + params.sq_off.ring_mask);
+    ring->sq_array = (unsigned*)(sq + params.sq_off.array);
+    ring->cq_head = (unsigned*)(cq + params.cq_off.head);
+    ring->cq_tail = (unsigned*)(cq + params.cq_off.tail);
+    ring->cq_mask = (unsigned*)(cq + params.cq_off.ring_mask);
+    ring->cqes = (struct io_uring_cqe*)(cq + params.cq_off.cqes);
+    ring->sq_entries = params.sq_entries;
+    ring->sq_local_tail = *ring->sq_tail;
+    return 0;
+}
+
+void uring_free(Uring *ring) {
+    munmap(ring->sqes, ring->sqes_size);
+    if (ring->cq_ring != ring->sq_ring) {
+        munmap(ring->cq_ring, ring->cq_ring_size);
+    }
+    munmap(ring->sq_ring, ring->sq_ring_size);
+    close(ring->fd);
+}
+
+int uring_enter(Uring *ring, unsigned min_complete, long long timeout_us) {
+    __atomic_store_n(ring->sq_tail, ring->sq_local_tail, __ATOMIC_RELEASE);
+    
+    struct __kernel_timespec ts;
+    struct io_uring_getevents_arg arg = {0};
+    if (timeout_us >= 0) {
+        ts.tv_sec = timeout_us / MICROSECONDS_PER_SECOND;
+        ts.tv_nsec = (timeout_us % MICROSECONDS_PER_SECOND) * 1000;
+        arg.ts = (unsigned long long)(uintptr_t)&ts;
+    }
+    unsigned flags = IORING_ENTER_EXT_ARG | (min_complete ? IORING_ENTER_GETEVENTS : 0);
+    int ret = (int)syscall(__NR_io_uring_enter, ring->fd, ring->to_submit, min_complete, flags,
+                           &arg, sizeof(arg));
+    if (ret > 0) {
+        ring->to_submit -= (unsigned)ret;
+    }
+    return ret < 0 && errno != ETIME && errno != EINTR && errno != EBUSY ? -1 : 0;
+}
+
+struct io_uring_sqe* uring_get_sqe(Uring *ring) {
+    unsigned head = __atomic_load_n(ring->sq_head, __ATOMIC_ACQUIRE);
+    if (ring->sq_local_tail - head >= ring->sq_entries) {
+        if (uring_enter(ring, 0, -1) != 0) {
+            return NULL;
+        }
+        head = __atomic_load_n(ring->sq_head, __ATOMIC_ACQUIRE);
+        if (ring->sq_local_tail - head >= ring->sq_entries) {
+            return NULL;
+        }
+    }
+    unsigned index = ring->sq_local_tail & *ring->sq_mask;
+    struct io_uring_sqe* sqe = &ring->sqes[index];
+    memset(sqe, 0, sizeof(*sqe));
+    ring->sq_array[index] = index;
+    ring->sq_local_tail++;
+    ring->to_submit++;
+    return sqe;
+}
+
+int uring_queue(Uring *ring, int op, int fd, void* buf, size_t len, Session *session) {
+    struct io_uring_sqe* sqe = uring_get_sqe(ring);
+    if (!sqe) {
+        return -1;
+    }
+    sqe->opcode = op == URING_OP_ACCEPT ? IORING_OP_ACCEPT : op == URING_OP_RECV ? IORING_OP_RECV : IORING_OP_SEND;
+    sqe->fd = fd;
+    sqe->addr = (unsigned long long)(uintptr_t)buf;
+    sqe->len = (unsigned)len;
+    if (op == URING_OP_ACCEPT) {
+        sqe->accept_flags = SOCK_NONBLOCK | SOCK_CLOEXEC;
+    } else if (op == URING_OP_SEND) {
+        sqe->msg_flags = MSG_NOSIGNAL;
+    }
+    sqe->user_data = (unsigned long long)(uintptr_t)session | (unsigned long long)op;
+    return 0;
+}
+
+void uring_complete(Server *server, Uring *ring, struct io_uring_cqe* cqe) {
+    int op = (int)(cqe->user_data & URING_OP_MASK);
+    Session *session = (Session*)(uintptr_t)(cqe->user_data & ~(unsigned long long)URING_OP_MASK);
+    
+    if (op == URING_OP_ACCEPT) {
+        if (cqe->res >= 0 && !server_add_session(server, cqe->res)) {
+            close(cqe->res);
+        }
+        if (server_stop) {
+            return;
+        }
+        if (cqe->res < 0 && accept_exhausted(-cqe->res)) {
+            server_pause_accept(server);
+        } else {
+            uring_queue(ring, URING_OP_ACCEPT, server->listen_fd, NULL, 0, NULL);
+        }
+        return;
+    }
+    
+    server_mark_dirty(server, session);
+    if (op == URING_OP_RECV) {
+        session->recv_inflight = 0;
+        if (cqe->res > 0) {
+            session_input(server, session, session->in_buf, cqe->res);
+            session_wake(server, session);
+        } else if (cqe->res != -EINTR && cqe->res != -EAGAIN) {
+            session_drop(session);
+        }
+    } else if (op == URING_OP_SEND) {
+        session->send_inflight = 0;
+        if (cqe->res < 0) {
+            if (cqe->res != -EINTR && cqe->res != -EAGAIN) {
+                session_drop(session);
+            }
             return;
         }
+        session->out_sent += (size_t)cqe->res;
+        session->bytes_sent += cqe->res;
+        if (session->out_sent == session->out.len) {
+            session->out.len = 0;
+            session->out_sent = 0;
+        }
+    }
+}
+
+int run_server_uring(Server *server) {
+    Uring ring;
+    if (uring_init(&ring, URING_ENTRIES) != 0) {
+        return -1;
+    }
+    server->epoll_fd = -1;
+    uring_queue(&ring, URING_OP_ACCEPT, server->listen_fd, NULL, 0, NULL);
+    long long timeout_us = -1;
+    int stopping = 0;
+    int failed = 0;
+    
+    while (!stopping || server->session_count > 0) {
+        if (uring_enter(&ring, 1, timeout_us) != 0) {
+            printf("Error: io_uring_enter failed: %s\n", strerror(errno));
+            failed = 1;
+            break;
+        }
+        
+        unsigned head = *ring.cq_head;
+        unsigned tail = __atomic_load_n(ring.cq_tail, __ATOMIC_ACQUIRE);
+        while (head != tail) {
+            uring_complete(server, &ring, &ring.cqes[head & *ring.cq_mask]);
+            head++;
+        }
+        __atomic_store_n(ring.cq_head, head, __ATOMIC_RELEASE);
+        
+        if (server_stop && !stopping) {
+            stopping = 1;
+            for (int i = 0; i < server->session_count; i++) {
+                session_drop(server->sessions[i]);
+                server_mark_dirty(server, server->sessions[i]);
+            }
+        }
+        
+        server->now = monotonic_us();
+        timer_wheel_advance(&server->timers, server->now, session_timer_fired, server);
+        if (server->accept_resume && !server_stop) {
+            server->accept_resume = 0;
+            uring_queue(&ring, URING_OP_ACCEPT, server->listen_fd, NULL, 0, NULL);
+        }
+        
+        Session *session = server->dirty_head;
+        server->dirty_head = NULL;
+        while (session) {
+            Session *next = session->dirty_next;
+            session->dirty = 0;
+            
+            if (session->closing && session->out.len == 0 && !session->shut_down) {
+                shutdown(session->fd, SHUT_RDWR);
+                session->shut_down = 1;
+            }
+            if (session->shut_down) {
+                if (!session->recv_inflight && !session->send_inflight) {
+                    session_close(server, session);
+                }
+            } else {
+                if (!session->recv_inflight &&
+                    uring_queue(&ring, URING_OP_RECV, session->fd, session->in_buf, sizeof(session->in_buf), session) == 0) {
+                    session->recv_inflight = 1;
+                }
+                if (!session->send_inflight && session->out_sent < session->out.len &&
+                    uring_queue(&ring, URING_OP_SEND, session->fd, session->out.data + session->out_sent,
+                                session->out.len - session->out_sent, session) == 0) {
+                    session->send_inflight = 1;
+                }
+            }
+            session = next;
+        }
+        
+        timeout_us = server_timeout_us(server);
+    }
+    
+    uring_free(&ring);
+    while (server->session_count > 0) {
+        session_close(server, server->sessions[server->session_count - 1]);
+    }
+    return failed;
+}
+
+int run_server(Config* cfg, const char* address) {
+    Server server = {0};
+    server.cfg = cfg;
+    server.seed = game_seed;
+    
+    struct rlimit limit;
+    if (getrlimit(RLIMIT_NOFILE, &limit) == 0 && limit.rlim_cur < limit.rlim_max) {
+        limit.rlim_cur = limit.rlim_max;
+        setrlimit(RLIMIT_NOFILE, &limit);
+    }
+    
+    server.listen_fd = server_listen(address);
+    if (server.listen_fd < 0) {
+        return 1;
+    }
+    server.now = monotonic_us();
+    timer_wheel_init(&server.timers, server.now);
+    
+    Swarm swarm;
+    if (swarm_snakes > 0) {
+        if (swarm_init(&swarm, cfg, swarm_snakes) != 0) {
+            swarm_free(&swarm);
+            close(server.listen_fd);
+            return 1;
+        }
+        swarm.track_changes = 1;
+        swarm_start(&swarm);
+        server.swarm = &swarm;
+        server.subscribers = calloc(swarm.tile_count, sizeof(TileSubscribers));
+        server.view_width = cfg->emoji_mode ? VIEW_WIDTH / 2 : VIEW_WIDTH;
+        if (server.view_width > cfg->board_width) {
+            server.view_width = cfg->board_width;
+        }
+        server.view_height = VIEW_HEIGHT < cfg->board_height ? VIEW_HEIGHT : cfg->board_height;
+        server.swarm_timer.owner = &server;
+        server.swarm_timer.kind = TIMER_SWARM;
+        timer_wheel_add(&server.timers, &server.swarm_timer, server.now + cfg->move_interval);
+    } else {
+        server.cells = malloc((size_t)cfg->board_width * cfg->board_height);
+    }
+    
+    signal(SIGPIPE, SIG_IGN);
+    signal(SIGINT, handle_server_signal);
+    signal(SIGTERM, handle_server_signal);
+    
+    int is_port = strspn(address, "0123456789") == strlen(address);
+    if (server.swarm) {
+        printf("Serving a %d-snake swarm on a %dx%d board on %s%s\n", swarm.snake_count, cfg->board_width,
+               cfg->board_height, is_port ? "127.0.0.1:" : "", address);
+    } else {
+        printf("Serving %dx%d games on %s%s\n", cfg->board_width, cfg->board_height,
+               is_port ? "127.0.0.1:" : "", address);
+    }
+    fflush(stdout);
+    
+    int failed = 0;
+    if (use_io_uring) {
+        failed = run_server_uring(&server);
+        if (failed < 0) {
+            printf("io_uring is not available, using epoll\n");
+            fflush(stdout);
+            use_io_uring = 0;
+        }
+    }
+    if (!use_io_uring) {
+        failed = run_server_epoll(&server);
+    }
+    
+    close(server.listen_fd);
+    if (!is_port) {
+        unlink(address);
+    }
+    free(server.sessions);
+    free(server.cells);
+    if (server.swarm) {
+        swarm_stop(&swarm);
+        for (int i = 0; i < swarm.tile_count; i++) {
+            free(server.subscribers[i].sessions);
+        }
+        free(server.subscribers);
+        printf("Swarm: %lld ticks, %lld viewport cell updates sent\n", swarm.ticks, server.view_changes);
+        swarm_free(&swarm);
+    }
+    
+    printf("Server stopped after %lld sessions\n", server.sessions_served);
+    if (server.session_us > 0) {
+        printf("Output: %lld bytes (%lld bytes/s per session)\n", server.bytes_sent,
+               server.bytes_sent * MICROSECONDS_PER_SECOND / server.session_us);
+    }
+    if (server.commands_applied > 0 || server.command_drops > 0) {
+        printf("Input: %lld commands, %lld dropped, max queue depth %zu, average wait %lld us\n",
+               server.commands_applied, server.command_drops, server.command_max_depth,
+               server.commands_applied ? server.command_wait_us / server.commands_applied : 0);
+    }
+    return failed;
+}
+
+int sixel_number(const char* data, size_t len, size_t *pos) {
+    int value = 0;
+    while (*pos < len && data[*pos] >= '0' && data[*pos] <= '9') {
+        value = value * 10 + (data[(*pos)++] - '0');
+    }
+    return value;
+}
+
+int sixel_expect(const char* data, size_t len, size_t *pos, char c) {
+    if (*pos >= len || data[*pos] != c) {
+        return 0;
+    }
+    (*pos)++;
+    return 1;
+}
+
+int sixel_decode(const char* data, size_t len, int width, int height, unsigned char* pixels,
+                 int palette[SIXEL_COLORS][3]) {
+    size_t pos = 0;
+    while (pos + 1 < len && !(data[pos] == 27 && data[pos + 1] == 'P')) {
+        pos++;
+    }
+    if (pos + 1 >= len) {
+        return 0;
+    }
+    pos += 2;
+    while (pos < len && data[pos] != 'q') {
+        pos++;
+    }
+    pos++;
+    
+    int attrs[4] = {0};
+    for (int i = 0; i < 4; i++) {
+        if (!sixel_expect(data, len, &pos, i == 0 ? '"' : ';')) {
+            return -1;
+        }
+        attrs[i] = sixel_number(data, len, &pos);
+    }
+    if (attrs[2] != width || attrs[3] != height) {
+        return -1;
+    }
+    
+    memset(pixels, 0xFF, (size_t)width * height);
+    int x = 0;
+    int band = 0;
+    int color = 0;
+    while (pos < len && data[pos] != 27) {
+        char c = data[pos++];
+        if (c == '#') {
+            color = sixel_number(data, len, &pos);
+            if (color >= SIXEL_COLORS) {
+                return -1;
+            }
+            if (sixel_expect(data, len, &pos, ';')) {
+                if (sixel_number(data, len, &pos) != 2) {
+                    return -1;
+                }
+                for (int k = 0; k < 3; k++) {
+                    if (!sixel_expect(data, len, &pos, ';')) {
+                        return -1;
+                    }
+                    palette[color][k] = sixel_number(data, len, &pos);
+                }
+            }
+            continue;
+        }
+        if (c == '$' || c == '-') {
+            band += c == '-';
+            x = 0;
+            continue;
+        }
+        int count = 1;
+        if (c == '!') {
+            count = sixel_number(data, len, &pos);
+            if (pos >= len) {
+                return -1;
+            }
+            c = data[pos++];
+        }
+        if (c < '?' || c > '~') {
+            return -1;
+        }
+        for (int i = 0; i < count; i++, x++) {
+            for (int b = 0; b < SIXEL_BAND_ROWS; b++) {
+                if (!((c - '?') >> b & 1)) {
+                    continue;
+                }
+                int y = band * SIXEL_BAND_ROWS + b;
+                if (x >= width || y >= height) {
+                    return -1;
+                }
+                pixels[(size_t)y * width + x] = (unsigned char)color;
+            }
+        }
+    }
+    return pos < len ? 1 : -1;
+}
+
+int run_sixel_check(Config* cfg, long long ticks) {
+    Game game;
+    Renderer renderer;
+    if (init_game(&game, cfg, seed_given ? game_seed : 1) != 0 || renderer_init(&renderer, cfg) != 0) {
+        printf("Error: Not enough memory for a %dx%d board\n", cfg->board_width, cfg->board_height);
+        cleanup_game(&game);
+        return 1;
+    }
+    renderer.newline = "\r\n";
+    
+    SixelCache *sixel = renderer.sixel;
+    int width = sixel->image_width;
+    int height = sixel->image_height;
+    unsigned char* cells = malloc((size_t)cfg->board_width * cfg->board_height);
+    unsigned char* pixels = malloc((size_t)width * height);
+    int palette[SIXEL_COLORS][3];
+    memset(palette, 0xFF, sizeof(palette));
+    OutBuf frame = {0};
+    unsigned long long hash = 0xCBF29CE484222325ULL;
+    long long bytes = 0;
+    long long frames = 0;
+    int images = 0;
+    int failed = 0;
+    
+    for (long long tick = 0; tick <= ticks && !failed; tick++) {
+        if (tick > 0) {
+            if (game.game_over) {
+                break;
+            }
+            game.snake.direction = autopilot_direction(&game, cfg);
+            move_snake(&game, cfg);
+        }
+        fill_cells(&game, cfg, cells);
+        frame.len = 0;
+        render_frame(&renderer, &game, cfg, cells, &frame);
+        for (size_t i = 0; i < frame.len; i++) {
+            hash = (hash ^ (unsigned char)frame.data[i]) * 0x100000001B3ULL;
+        }
+        bytes += (long long)frame.len;
+        frames++;
+        
+        int decoded = sixel_decode(frame.data, frame.len, width, height, pixels, palette);
+        if (decoded < 0 || (decoded == 0 && images == 0)) {
+            printf("Error: Frame %lld does not hold a well-formed %dx%d sixel image\n", tick, width, height);
+            failed = 1;
+            break;
+        }
+        images += decoded;
+        for (int y = 0; y < height && !failed; y++) {
+            int cy = y / sixel->cell_size;
+            for (int x = 0; x < width; x++) {
+                int cx = x / sixel->cell_size;
+                int expected = cx == 0 || cy == 0 || cx == sixel->width - 1 || cy == sixel->height - 1
+                                   ? CELL_WALL : cells[(size_t)(cy - 1) * cfg->board_width + cx - 1];
+                if (pixels[(size_t)y * width + x] != expected) {
+                    printf("Error: Frame %lld shows color %d at pixel %d,%d where the board has %d\n", tick,
+                           pixels[(size_t)y * width + x], x, y, expected);
+                    failed = 1;
+                    break;
+                }
+            }
+        }
+    }
+    for (int c = 0; c < SIXEL_COLORS && !failed; c++) {
+        for (int k = 0; k < 3; k++) {
+            if (palette[c][k] != (cell_rgb[c][k] * 100 + 127) / 255) {
+                printf("Error: Sixel color %d is not defined as the board palette expects\n", c);
+                failed = 1;
+                break;
+            }
+        }
+    }
+    
+    printf("Sixel check: %lld frames of a %dx%d board at %d px per cell, %d images, %lld bands encoded\n",
+           frames, cfg->board_width, cfg->board_height, sixel->cell_size, images, sixel->bands_encoded);
+    printf("Output: %lld bytes, FNV-1a %016llx\n", bytes, hash);
+    if (!failed) {
+        printf("Every frame decodes to the board it was rendered from\n");
+    }
+    
+    outbuf_free(&frame);
+    free(pixels);
+    free(cells);
+    renderer_free(&renderer);
+    cleanup_game(&game);
+    return failed;
+}
+
+int pty_match_feed(PtyMatch *match, const char* data, size_t len) {
+    if (match->length == 0) {
+        return len > 0;
+    }
+    int found = 0;
+    for (size_t i = 0; i < len; i++) {
+        if (data[i] == match->text[match->matched]) {
+            match->matched++;
+        } else {
+            match->matched = data[i] == match->text[0];
+        }
+        if (match->matched == match->length) {
+            match->matched = 0;
+            found = 1;
+        }
+    }
+    return found;
+}
+
+int pty_screen_feed(PtyScreen *screen, const char* data, size_t len) {
+    int turned = 0;
+    for (size_t i = 0; i < len; i++) {
+        unsigned char c = (unsigned char)data[i];
+        if (screen->escape == 1) {
+            screen->escape = c == '[' ? 2 : 0;
+            screen->params[0] = 0;
+            screen->params[1] = 0;
+            screen->param_count = 0;
+        } else if (screen->escape == 2) {
+            if (c >= '0' && c <= '9') {
+                if (screen->param_count < 2) {
+                    screen->params[screen->param_count] = screen->params[screen->param_count] * 10 + (c - '0');
+                }
+            } else if (c == ';') {
+                screen->param_count++;
+            } else if (c >= 0x40) {
+                if (c == 'H') {
+                    screen->row = screen->params[0] ? screen->params[0] : 1;
+                    screen->col = screen->params[1] ? screen->params[1] : 1;
+                }
+                screen->escape = 0;
+            }
+        } else if (c == 27) {
+            screen->escape = 1;
+        } else if (c == '\r') {
+            screen->col = 1;
+        } else if (c == '\n') {
+            screen->row++;
+        } else if (c >= ' ' && (c & 0xC0) != 0x80) {
+            if (c == '@' && (screen->row != screen->head_row || screen->col != screen->head_col)) {
+                int dx = screen->col - screen->head_col;
+                int dy = screen->row - screen->head_row;
+                if (screen->head_row && (screen->want_dx || screen->want_dy) &&
+                    dx == screen->want_dx && dy == screen->want_dy) {
+                    screen->want_dx = 0;
+                    screen->want_dy = 0;
+                    turned = 1;
+                }
+                screen->head_row = screen->row;
+                screen->head_col = screen->col;
+            }
+            screen->col++;
+        }
+    }
+    return turned;
+}
+
+int pty_bench_start(PtyBench *bench, int argc, char *argv[], int steer) {
+    memset(bench, 0, sizeof(*bench));
+    bench->paused = (PtyMatch){"PAUSED", 6, 0};
+    bench->game_over = (PtyMatch){"Game Over", 9, 0};
+    bench->prompt = (PtyMatch){"Press Enter", 11, 0};
+    
+    bench->master = posix_openpt(O_RDWR | O_NOCTTY | O_CLOEXEC);
+    if (bench->master < 0 || grantpt(bench->master) != 0 || unlockpt(bench->master) != 0) {
+        printf("Error: Cannot create a pseudo-terminal: %s\n", strerror(errno));
+        return 1;
+    }
+    struct winsize size = {PTY_BENCH_ROWS, PTY_BENCH_COLS, 0, 0};
+    ioctl(bench->master, TIOCSWINSZ, &size);
+    const char* slave = ptsname(bench->master);
+    
+    char** args = calloc(argc + 5, sizeof(char*));
+    int count = 0;
+    for (int i = 0; i < argc; i++) {
+        if (strcmp(argv[i], "--pty-bench") == 0) {
+            i++;
+            continue;
+        }
+        args[count++] = argv[i];
+    }
+    if (!steer && autopilot_policy < 0 && !bot_cmd) {
+        args[count++] = "--autopilot";
+        args[count++] = "greedy";
+    }
+    if (!seed_given) {
+        args[count++] = "--seed";
+        args[count++] = "1";
+    }
+    
+    fflush(stdout);
+    bench->pid = fork();
+    if (bench->pid == 0) {
+        setsid();
+        int fd = open(slave, O_RDWR);
+        if (fd < 0) {
+            _exit(127);
+        }
+        dup2(fd, STDIN_FILENO);
+        dup2(fd, STDOUT_FILENO);
+        dup2(fd, STDERR_FILENO);
+        if (fd > STDERR_FILENO) {
+            close(fd);
+        }
+        execv("/proc/self/exe", args);
+        _exit(127);
+    }
+    free(args);
+    if (bench->pid < 0) {
+        printf("Error: Cannot start the game: %s\n", strerror(errno));
+        return 1;
+    }
+    return 0;
+}
+
+int pty_bench_pump(PtyBench *bench, long long deadline_us, PtyMatch *until, long long *seen_us) {
+    char buf[65536];
+    while (1) {
+        long long remaining = deadline_us - monotonic_us();
+        if (remaining < 0) {
+            return 0;
+        }
+        struct pollfd pfd = {bench->master, POLLIN, 0};
+        struct timespec timeout = {remaining / MICROSECONDS_PER_SECOND, remaining % MICROSECONDS_PER_SECOND * 1000};
+        int ready = ppoll(&pfd, 1, &timeout, NULL);
+        if (ready < 0 && errno != EINTR) {
+            return -1;
+        }
+        if (ready <= 0) {
+            continue;
+        }
+        ssize_t got = read(bench->master, buf, sizeof(buf));
+        long long now = monotonic_us();
+        if (got <= 0) {
+            if (got < 0 && errno == EINTR) {
+                continue;
+            }
+            return -1;
+        }
+        bench->bytes += got;
+        int turned = pty_screen_feed(&bench->screen, buf, got);
+        if ((until && pty_match_feed(until, buf, got)) || turned) {
+            if (seen_us) {
+                *seen_us = now;
+            }
+            return 1;
+        }
+        if (pty_match_feed(&bench->game_over, buf, got)) {
+            bench->ended = 1;
+            return 0;
+        }
+    }
+}
+
+void pty_bench_stop(PtyBench *bench) {
+    if (bench->pid > 0) {
+        long long deadline = monotonic_us() + PTY_BENCH_TIMEOUT_US;
+        if (!bench->ended) {
+            write_all(bench->master, "q", 1);
+        }
+        if (pty_bench_pump(bench, deadline, &bench->prompt, NULL) == 1) {
+            write_all(bench->master, "\n", 1);
+        }
+        while (pty_bench_pump(bench, deadline, NULL, NULL) > 0) {
+        }
+        if (waitpid(bench->pid, NULL, WNOHANG) == 0) {
+            kill(bench->pid, SIGKILL);
+            waitpid(bench->pid, NULL, 0);
+        }
+    }
+    if (bench->master >= 0) {
+        close(bench->master);
+    }
+}
+
+void pty_bench_report(const char* name, int* samples, int count) {
+    if (count == 0) {
+        return;
+    }
+    qsort(samples, count, sizeof(int), compare_ints);
+    printf("%s: %d samples, min %.2f ms, p50 %.2f ms, p90 %.2f ms, p99 %.2f ms, max %.2f ms\n", name, count,
+           samples[0] / 1000.0, samples[(count - 1) * 50 / 100] / 1000.0, samples[(count - 1) * 90 / 100] / 1000.0,
+           samples[(count - 1) * 99 / 100] / 1000.0, samples[count - 1] / 1000.0);
+}
+
+int pty_bench_first_frame(PtyBench *bench, long long *frame_us) {
+    PtyMatch status = {"Score:", 6, 0};
+    long long started = monotonic_us();
+    if (pty_bench_pump(bench, started + PTY_BENCH_TIMEOUT_US, &status, frame_us) != 1) {
+        printf("Error: The game did not draw a frame within %d ms\n", PTY_BENCH_TIMEOUT_US / 1000);
+        return 1;
+    }
+    return 0;
+}
+
+int pty_bench_turns(Config* cfg, int argc, char *argv[], int* samples, int* count, int* ended) {
+    static const char turn_keys[4] = {'s', 'a', 'w', 'd'};
+    static const int turn_dx[4] = {0, -1, 0, 1};
+    static const int turn_dy[4] = {1, 0, -1, 0};
+    PtyBench bench;
+    long long response = 0;
+    if (pty_bench_start(&bench, argc, argv, 1) != 0 || pty_bench_first_frame(&bench, &response) != 0) {
+        pty_bench_stop(&bench);
+        return 1;
     }
     
-    if (cfg->game_mode == MODE_GREEDY) {
-        if (game->snake.length >= game->snake.max_length) {
-            game->game_over = 1;
-            return;
+    int failed = 0;
+    unsigned long long rng = game_seed | 1;
+    for (int press = 0; press < pty_bench_keys; press++) {
+        long long gap = PTY_BENCH_TURN_MOVES * cfg->move_interval + rng_next(&rng) % cfg->move_interval;
+        if (pty_bench_pump(&bench, response + gap, NULL, NULL) < 0 || bench.ended) {
+            break;
+        }
+        
+        int turn = press % 4;
+        bench.screen.want_dx = turn_dx[turn];
+        bench.screen.want_dy = turn_dy[turn];
+        long long sent = monotonic_us();
+        if (write_all(bench.master, &turn_keys[turn], 1) != 0) {
+            break;
+        }
+        int got = pty_bench_pump(&bench, sent + PTY_BENCH_TIMEOUT_US, NULL, &response);
+        if (got < 0 || bench.ended) {
+            break;
+        }
+        if (got == 0) {
+            printf("Error: Turn %d did not move the head within %d ms\n", press + 1, PTY_BENCH_TIMEOUT_US / 1000);
+            failed = 1;
+            break;
+        }
+        samples[(*count)++] = (int)(response - sent);
+    }
+    *ended = bench.ended;
+    pty_bench_stop(&bench);
+    return failed;
+}
+
+int run_pty_bench(Config* cfg, int argc, char *argv[]) {
+    PtyBench bench;
+    long long started = monotonic_us();
+    long long response = 0;
+    if (pty_bench_start(&bench, argc, argv, 0) != 0 || pty_bench_first_frame(&bench, &response) != 0) {
+        pty_bench_stop(&bench);
+        return 1;
+    }
+    long long first_frame_us = response - started;
+    
+    PtyMatch any_output = {"", 0, 0};
+    
+    int* pause_samples = calloc(pty_bench_keys, sizeof(int));
+    int* resume_samples = calloc(pty_bench_keys, sizeof(int));
+    int pauses = 0;
+    int resumes = 0;
+    int paused = 0;
+    int failed = 0;
+    unsigned long long rng = game_seed | 1;
+    long long running_since = response;
+    long long running_bytes = 0;
+    long long running_us = 0;
+    long long bytes_at_resume = bench.bytes;
+    
+    for (int press = 0; press < pty_bench_keys; press++) {
+        long long gap = (paused ? PTY_BENCH_PAUSE_US : PTY_BENCH_RUN_US) + rng_next(&rng) % cfg->render_interval;
+        if (pty_bench_pump(&bench, response + gap, NULL, NULL) < 0 || bench.ended) {
+            break;
         }
         
-        for (int i = game->snake.length - 1; i >= 0; i--) {
-            game->snake.body[i + 1] = game->snake.body[i];
+        long long sent = monotonic_us();
+        if (write_all(bench.master, " ", 1) != 0) {
+            break;
         }
-        game->snake.body[0] = new_head;
-        game->snake.length++;
-        
-        if (ate_food) {
-            game->score += POINTS_PER_FOOD;
-            generate_food(game, cfg);
+        PtyMatch* until = paused ? &any_output : &bench.paused;
+        until->matched = 0;
+        int got = pty_bench_pump(&bench, sent + PTY_BENCH_TIMEOUT_US, until, &response);
+        if (got < 0 || bench.ended) {
+            break;
         }
-    } else {
-        for (int i = game->snake.length - 1; i > 0; i--) {
-            game->snake.body[i] = game->snake.body[i - 1];
-        }
-        game->snake.body[0] = new_head;
-        
-        if (ate_food) {
-            game->snake.length++;
-            game->score += POINTS_PER_FOOD;
-            generate_food(game, cfg);
-        }
-    }
-}
-
-void handle_input(Game *game) {
-    if (kbhit()) {
-        char c = getchar();
-        if (c == 27) {
-            if (kbhit()) {
-                char seq1 = getchar();
-                if (seq1 == '[' && kbhit()) {
-                    char seq2 = getchar();
-                    switch (seq2) {
-                        case 'A':
-                            if (game->snake.direction != DOWN) {
-                                game->snake.direction = UP;
-                            }
-                            break;
-                        case 'B':
-                            if (game->snake.direction != UP) {
-                                game->snake.direction = DOWN;
-                            }
-                            break;
-                        case 'C':
-                            if (game->snake.direction != LEFT) {
-                                game->snake.direction = RIGHT;
-                            }
-                            break;
-                        case 'D':
-                            if (game->snake.direction != RIGHT) {
-                                game->snake.direction = LEFT;
-                            }
-                            break;
-                    }
-                }
-            }
+        if (got == 0) {
+            printf("Error: Key press %d got no response within %d ms\n", press + 1, PTY_BENCH_TIMEOUT_US / 1000);
+            failed = 1;
+            break;
+        }
+        
+        if (paused) {
+            resume_samples[resumes++] = (int)(response - sent);
+            running_since = response;
+            bytes_at_resume = bench.bytes;
         } else {
-            switch (c) {
-                case 'w':
-                case 'W':
-                    if (game->snake.direction != DOWN) {
-                        game->snake.direction = UP;
-                    }
-                    break;
-                case 's':
-                case 'S':
-                    if (game->snake.direction != UP) {
-                        game->snake.direction = DOWN;
-                    }
-                    break;
-                case 'a':
-                case 'A':
-                    if (game->snake.direction != RIGHT) {
-                        game->snake.direction = LEFT;
-                    }
-                    break;
-                case 'd':
-                case 'D':
-                    if (game->snake.direction != LEFT) {
-                        game->snake.direction = RIGHT;
-                    }
-                    break;
-                case 'q':
-                case 'Q':
-                    game->game_over = 1;
-                    break;
-                case ' ':
-                    game->paused = !game->paused;
-                    break;
-            }
+            pause_samples[pauses++] = (int)(response - sent);
+            running_us += response - running_since;
+            running_bytes += bench.bytes - bytes_at_resume;
         }
+        paused = !paused;
+    }
+    if (!paused) {
+        running_us += monotonic_us() - running_since;
+        running_bytes += bench.bytes - bytes_at_resume;
+    }
+    int ended = bench.ended;
+    pty_bench_stop(&bench);
+    
+    int* turn_samples = calloc(pty_bench_keys, sizeof(int));
+    int turns = 0;
+    int turns_ended = 0;
+    int steerable = autopilot_policy < 0 && !bot_cmd && !cfg->emoji_mode && cfg->render_profile != RENDER_SIXEL;
+    if (!failed && steerable) {
+        failed = pty_bench_turns(cfg, argc, argv, turn_samples, &turns, &turns_ended);
+    }
+    
+    printf("PTY bench: %d key presses in a %dx%d terminal, first frame after %.2f ms\n", pauses + resumes + turns,
+           PTY_BENCH_COLS, PTY_BENCH_ROWS, first_frame_us / 1000.0);
+    if (ended) {
+        printf("The game ended before all key presses were sent\n");
+    }
+    if (turns_ended) {
+        printf("The steered game ended before all turns were sent\n");
+    }
+    if (!steerable) {
+        printf("Turns are only measured without --autopilot, --bot-cmd, --emoji or --sixel\n");
     }
+    pty_bench_report("Pause (key to PAUSED on screen)", pause_samples, pauses);
+    pty_bench_report("Resume (key to next output)", resume_samples, resumes);
+    pty_bench_report("Turn (key to head moving the new way)", turn_samples, turns);
+    if (running_us > 0) {
+        printf("Output while running: %lld bytes in %lld ms (%lld bytes/s)\n", running_bytes, running_us / 1000,
+               running_bytes * MICROSECONDS_PER_SECOND / running_us);
+    }
+    free(pause_samples);
+    free(resume_samples);
+    free(turn_samples);
+    return failed;
 }
 
 int parse_arguments(int argc, char *argv[], Config* cfg) {
@@ -477,6 +6764,40 @@ int parse_arguments(int argc, char *argv[], Config* cfg) {
             cfg->wraparound_mode = 1;
         } else if (strcmp(argv[i], "--emoji") == 0) {
             cfg->emoji_mode = 1;
+        } else if (strcmp(argv[i], "--render-profile") == 0) {
+            if (i + 1 < argc) {
+                char* profile = argv[++i];
+                if (strcmp(profile, "full") == 0) {
+                    cfg->render_profile = RENDER_FULL;
+                } else if (strcmp(profile, "bandwidth") == 0) {
+                    cfg->render_profile = RENDER_BANDWIDTH;
+                } else {
+                    printf("Error: Unknown render profile '%s'. Available profiles: full, bandwidth\n", profile);
+                    return 1;
+                }
+                render_profile_given = 1;
+            } else {
+                printf("Error: --render-profile requires a profile name\n");
+                print_usage(argv[0]);
+                return 1;
+            }
+        } else if (strcmp(argv[i], "--sixel") == 0) {
+            cfg->render_profile = RENDER_SIXEL;
+            render_profile_given = 1;
+        } else if (strcmp(argv[i], "--sixel-check") == 0) {
+            if (i + 1 < argc) {
+                sixel_check_ticks = atoll(argv[++i]);
+                if (sixel_check_ticks <= 0) {
+                    printf("Error: Sixel check tick count must be a positive integer\n");
+                    return 1;
+                }
+                cfg->render_profile = RENDER_SIXEL;
+                render_profile_given = 1;
+            } else {
+                printf("Error: --sixel-check requires a tick count\n");
+                print_usage(argv[0]);
+                return 1;
+            }
         } else if (strcmp(argv[i], "--mode") == 0) {
             if (i + 1 < argc) {
                 char* mode = argv[++i];
@@ -493,6 +6814,243 @@ int parse_arguments(int argc, char *argv[], Config* cfg) {
                 print_usage(argv[0]);
                 return 1;
             }
+        } else if (strcmp(argv[i], "--record") == 0) {
+            if (i + 1 < argc) {
+                record_path = argv[++i];
+            } else {
+                printf("Error: --record requires a file path\n");
+                print_usage(argv[0]);
+                return 1;
+            }
+        } else if (strcmp(argv[i], "--replay") == 0) {
+            if (i + 1 < argc) {
+                replay_path = argv[++i];
+            } else {
+                printf("Error: --replay requires a file path\n");
+                print_usage(argv[0]);
+                return 1;
+            }
+        } else if (strcmp(argv[i], "--seek") == 0) {
+            if (i + 1 < argc) {
+                replay_start_tick = atoll(argv[++i]);
+                if (replay_start_tick < 0) {
+                    printf("Error: Seek tick must not be negative\n");
+                    return 1;
+                }
+            } else {
+                printf("Error: --seek requires a tick number\n");
+                print_usage(argv[0]);
+                return 1;
+            }
+        } else if (strcmp(argv[i], "--keyframe-interval") == 0) {
+            if (i + 1 < argc) {
+                keyframe_interval = atoi(argv[++i]);
+                if (keyframe_interval <= 0) {
+                    printf("Error: Keyframe interval must be a positive integer\n");
+                    return 1;
+                }
+            } else {
+                printf("Error: --keyframe-interval requires a tick count\n");
+                print_usage(argv[0]);
+                return 1;
+            }
+        } else if (strcmp(argv[i], "--checksum-interval") == 0) {
+            if (i + 1 < argc) {
+                checksum_interval = atoi(argv[++i]);
+                if (checksum_interval <= 0) {
+                    printf("Error: Checksum interval must be a positive integer\n");
+                    return 1;
+                }
+            } else {
+                printf("Error: --checksum-interval requires a tick count\n");
+                print_usage(argv[0]);
+                return 1;
+            }
+        } else if (strcmp(argv[i], "--export-cast") == 0) {
+            if (i + 1 < argc) {
+                export_cast_path = argv[++i];
+            } else {
+                printf("Error: --export-cast requires a file path\n");
+                print_usage(argv[0]);
+                return 1;
+            }
+        } else if (strcmp(argv[i], "--export-ppm") == 0) {
+            if (i + 1 < argc) {
+                export_ppm_dir = argv[++i];
+            } else {
+                printf("Error: --export-ppm requires a directory\n");
+                print_usage(argv[0]);
+                return 1;
+            }
+        } else if (strcmp(argv[i], "--export-y4m") == 0) {
+            if (i + 1 < argc) {
+                export_y4m_path = argv[++i];
+            } else {
+                printf("Error: --export-y4m requires a file path\n");
+                print_usage(argv[0]);
+                return 1;
+            }
+        } else if (strcmp(argv[i], "--cell-size") == 0) {
+            if (i + 1 < argc) {
+                export_cell_size = atoi(argv[++i]);
+                cell_size_given = 1;
+                if (export_cell_size <= 0) {
+                    printf("Error: Cell size must be a positive integer\n");
+                    return 1;
+                }
+            } else {
+                printf("Error: --cell-size requires a pixel value\n");
+                print_usage(argv[0]);
+                return 1;
+            }
+        } else if (strcmp(argv[i], "--threads") == 0) {
+            if (i + 1 < argc) {
+                worker_threads = atoi(argv[++i]);
+                if (worker_threads <= 0) {
+                    printf("Error: Thread count must be a positive integer\n");
+                    return 1;
+                }
+            } else {
+                printf("Error: --threads requires a count\n");
+                print_usage(argv[0]);
+                return 1;
+            }
+        } else if (strcmp(argv[i], "--batch") == 0) {
+            if (i + 1 < argc) {
+                batch_games = atoll(argv[++i]);
+                if (batch_games <= 0) {
+                    printf("Error: Batch size must be a positive integer\n");
+                    return 1;
+                }
+            } else {
+                printf("Error: --batch requires a game count\n");
+                print_usage(argv[0]);
+                return 1;
+            }
+        } else if (strcmp(argv[i], "--autopilot") == 0) {
+            if (i + 1 < argc) {
+                char* name = argv[++i];
+                for (int p = 0; p < (int)(sizeof(policies) / sizeof(policies[0])); p++) {
+                    if (strcmp(name, policies[p].name) == 0) {
+                        autopilot_policy = p;
+                    }
+                }
+                if (autopilot_policy < 0) {
+                    printf("Error: Unknown autopilot '%s'. Available autopilots: greedy, search\n", name);
+                    return 1;
+                }
+            } else {
+                printf("Error: --autopilot requires a policy name\n");
+                print_usage(argv[0]);
+                return 1;
+            }
+        } else if (strcmp(argv[i], "--decision-budget") == 0) {
+            if (i + 1 < argc) {
+                decision_budget_us = atoll(argv[++i]);
+                if (decision_budget_us <= 0) {
+                    printf("Error: Decision budget must be a positive integer\n");
+                    return 1;
+                }
+            } else {
+                printf("Error: --decision-budget requires a time in microseconds\n");
+                print_usage(argv[0]);
+                return 1;
+            }
+        } else if (strcmp(argv[i], "--bot-cmd") == 0) {
+            if (i + 1 < argc) {
+                bot_cmd = argv[++i];
+            } else {
+                printf("Error: --bot-cmd requires a command\n");
+                print_usage(argv[0]);
+                return 1;
+            }
+        } else if (strcmp(argv[i], "--dump-dataset") == 0) {
+            if (i + 1 < argc) {
+                dataset_dir = argv[++i];
+            } else {
+                printf("Error: --dump-dataset requires a directory\n");
+                print_usage(argv[0]);
+                return 1;
+            }
+        } else if (strcmp(argv[i], "--solve") == 0) {
+            solve_board = 1;
+        } else if (strcmp(argv[i], "--bot-shm") == 0) {
+            bot_shared = 1;
+        } else if (strcmp(argv[i], "--swarm") == 0) {
+            if (i + 1 < argc) {
+                swarm_snakes = atoi(argv[++i]);
+                if (swarm_snakes <= 0) {
+                    printf("Error: Swarm size must be a positive integer\n");
+                    return 1;
+                }
+            } else {
+                printf("Error: --swarm requires a snake count\n");
+                print_usage(argv[0]);
+                return 1;
+            }
+        } else if (strcmp(argv[i], "--ticks") == 0) {
+            if (i + 1 < argc) {
+                swarm_ticks = atoll(argv[++i]);
+                if (swarm_ticks <= 0) {
+                    printf("Error: Tick count must be a positive integer\n");
+                    return 1;
+                }
+            } else {
+                printf("Error: --ticks requires a count\n");
+                print_usage(argv[0]);
+                return 1;
+            }
+        } else if (strcmp(argv[i], "--huge-pages") == 0) {
+            if (i + 1 < argc) {
+                char* mode = argv[++i];
+                if (strcmp(mode, "auto") == 0) {
+                    huge_pages = HUGE_PAGES_AUTO;
+                } else if (strcmp(mode, "thp") == 0) {
+                    huge_pages = HUGE_PAGES_THP;
+                } else if (strcmp(mode, "off") == 0) {
+                    huge_pages = HUGE_PAGES_OFF;
+                } else {
+                    printf("Error: Unknown huge page mode '%s'. Available modes: auto, thp, off\n", mode);
+                    return 1;
+                }
+            } else {
+                printf("Error: --huge-pages requires a mode\n");
+                print_usage(argv[0]);
+                return 1;
+            }
+        } else if (strcmp(argv[i], "--seed") == 0) {
+            if (i + 1 < argc) {
+                game_seed = strtoull(argv[++i], NULL, 10);
+                seed_given = 1;
+            } else {
+                printf("Error: --seed requires a number\n");
+                print_usage(argv[0]);
+                return 1;
+            }
+        } else if (strcmp(argv[i], "--serve") == 0) {
+            if (i + 1 < argc) {
+                serve_address = argv[++i];
+            } else {
+                printf("Error: --serve requires a socket path or port\n");
+                print_usage(argv[0]);
+                return 1;
+            }
+        } else if (strcmp(argv[i], "--io-uring") == 0) {
+            use_io_uring = 1;
+        } else if (strcmp(argv[i], "--perf-counters") == 0) {
+            use_perf_counters = 1;
+        } else if (strcmp(argv[i], "--pty-bench") == 0) {
+            if (i + 1 < argc) {
+                pty_bench_keys = atoi(argv[++i]);
+                if (pty_bench_keys <= 0) {
+                    printf("Error: Key press count must be a positive integer\n");
+                    return 1;
+                }
+            } else {
+                printf("Error: --pty-bench requires a key press count\n");
+                print_usage(argv[0]);
+                return 1;
+            }
         } else if (strcmp(argv[i], "--help") == 0) {
             print_usage(argv[0]);
             return -1;
@@ -502,6 +7060,57 @@ int parse_arguments(int argc, char *argv[], Config* cfg) {
             return 1;
         }
     }
+    int exports = (export_cast_path != NULL) + (export_ppm_dir != NULL) + (export_y4m_path != NULL);
+    if (exports > 0 && !replay_path) {
+        printf("Error: Exporting requires --replay FILE\n");
+        return 1;
+    }
+    if (exports > 1) {
+        printf("Error: Only one export format can be used at a time\n");
+        return 1;
+    }
+    if (batch_games > 0 && swarm_snakes > 0) {
+        printf("Error: --batch cannot be combined with --swarm\n");
+        return 1;
+    }
+    if (solve_board && (batch_games > 0 || swarm_snakes > 0 || serve_address || replay_path)) {
+        printf("Error: --solve cannot be combined with --batch, --swarm, --serve or --replay\n");
+        return 1;
+    }
+    if (bot_cmd && autopilot_policy >= 0) {
+        printf("Error: --bot-cmd cannot be combined with --autopilot\n");
+        return 1;
+    }
+    if (dataset_dir && batch_games <= 0) {
+        printf("Error: --dump-dataset requires --batch\n");
+        return 1;
+    }
+    if (bot_shared && !bot_cmd) {
+        printf("Error: --bot-shm requires --bot-cmd\n");
+        return 1;
+    }
+    if (use_perf_counters && (batch_games > 0 || swarm_snakes > 0 || serve_address || solve_board || exports > 0 ||
+                              (record_path && replay_path))) {
+        printf("Error: --perf-counters only applies to a local game or replay playback\n");
+        return 1;
+    }
+    if (pty_bench_keys > 0 && (batch_games > 0 || swarm_snakes > 0 || serve_address || solve_board || replay_path)) {
+        printf("Error: --pty-bench only applies to a local game\n");
+        return 1;
+    }
+    if (sixel_check_ticks > 0 && (batch_games > 0 || swarm_snakes > 0 || serve_address || solve_board || replay_path ||
+                                  pty_bench_keys > 0)) {
+        printf("Error: --sixel-check cannot be combined with other modes\n");
+        return 1;
+    }
+    if (cfg->render_profile == RENDER_SIXEL && (batch_games > 0 || swarm_snakes > 0 || solve_board || replay_path)) {
+        printf("Error: --sixel only applies to a local game or --serve\n");
+        return 1;
+    }
+    if (record_path && replay_path && exports > 0) {
+        printf("Error: --record cannot be combined with an export\n");
+        return 1;
+    }
     return 0;
 }
 
@@ -512,49 +7121,227 @@ int main(int argc, char *argv[]) {
     }
     
     calculate_intervals(&config);
+    if (!seed_given) {
+        game_seed = (unsigned long long)time(NULL);
+    }
+    
+    if (solve_board) {
+        config.board_width = override_width > 0 ? override_width : SOLVE_DEFAULT_SIZE;
+        config.board_height = override_height > 0 ? override_height : SOLVE_DEFAULT_SIZE;
+        return run_solver(&config);
+    }
+    
+    if (swarm_snakes > 0) {
+        config.board_width = override_width > 0 ? override_width : SWARM_DEFAULT_SIZE;
+        config.board_height = override_height > 0 ? override_height : SWARM_DEFAULT_SIZE;
+        if (!serve_address) {
+            return run_swarm(&config, swarm_snakes);
+        }
+    }
+    
+    if (batch_games > 0) {
+        if (override_width > 0) config.board_width = override_width;
+        if (override_height > 0) config.board_height = override_height;
+        return run_batch(&config, batch_games);
+    }
+    
+    if (serve_address) {
+        if (!render_profile_given) config.render_profile = RENDER_BANDWIDTH;
+        if (override_width > 0) config.board_width = override_width;
+        if (override_height > 0) config.board_height = override_height;
+        return run_server(&config, serve_address);
+    }
+    
+    if (pty_bench_keys > 0) {
+        return run_pty_bench(&config, argc, argv);
+    }
+    
+    if (sixel_check_ticks > 0) {
+        if (override_width > 0) config.board_width = override_width;
+        if (override_height > 0) config.board_height = override_height;
+        return run_sixel_check(&config, sixel_check_ticks);
+    }
+    
+    PerfCounters perf;
+    if (use_perf_counters) {
+        if (perf_open(&perf) != 0) {
+            return 1;
+        }
+        active_perf = &perf;
+    }
+    
+    if (replay_path) {
+        ReplayReader replay;
+        if (replay_reader_open(&replay, replay_path) != 0) {
+            return 1;
+        }
+        replay_reader_apply(&replay, &config);
+        int result;
+        if (record_path) {
+            result = rerecord_replay(&replay, &config, record_path);
+        } else if (export_cast_path) {
+            result = export_cast(&replay, &config, export_cast_path);
+        } else if (export_ppm_dir || export_y4m_path) {
+            result = export_images(&replay, &config);
+        } else {
+            result = play_replay(&replay, &config);
+        }
+        result |= replay_reader_report(&replay);
+        replay_reader_close(&replay);
+        perf_close(active_perf);
+        return result;
+    }
     
     Game game;
+    ReplayWriter recorder = {0};
+    unsigned long long seed = game_seed;
+    
+    get_terminal_size(&config);
+    if (record_path && replay_writer_open(&recorder, record_path, &config, seed) != 0) {
+        return 1;
+    }
+    Pilot pilot = {0};
+    Bot bot = {0};
+    const Policy* policy = bot_cmd ? &bot_pilot_policy : autopilot_policy >= 0 ? &policies[autopilot_policy] : NULL;
+    if (policy &&
+        pilot_init(&pilot, policy, decision_budget_us > 0 ? decision_budget_us : config.move_interval / 2,
+                   &config) != 0) {
+        printf("Error: Not enough memory for the %s autopilot\n", policy->name);
+        pilot_free(&pilot);
+        return 1;
+    }
+    
+    if (init_game(&game, &config, seed) != 0) {
+        printf("Error: Not enough memory for a %dx%d board\n", config.board_width, config.board_height);
+        pilot_free(&pilot);
+        replay_writer_close(&recorder);
+        return 1;
+    }
+    if (bot_cmd) {
+        pilot.bot = &bot;
+        if (bot_start(&bot, &game, &config, bot_cmd, bot_shared) != 0) {
+            bot_stop(&bot, &game);
+            pilot_free(&pilot);
+            cleanup_game(&game);
+            replay_writer_close(&recorder);
+            return 1;
+        }
+    }
+    
+    Renderer renderer;
+    if (renderer_init(&renderer, &config) != 0) {
+        printf("Error: Not enough memory for a %dx%d board\n", config.board_width, config.board_height);
+        if (bot_cmd) {
+            bot_stop(&bot, &game);
+        }
+        pilot_free(&pilot);
+        cleanup_game(&game);
+        replay_writer_close(&recorder);
+        return 1;
+    }
+    
+    CommandQueue commands;
+    command_queue_init(&commands);
+    long long commands_applied = 0;
+    long long command_wait_us = 0;
+    KeyReader reader;
+    if (key_reader_start(&reader, &commands, !pilot.policy) != 0) {
+        printf("Error: Cannot start the input thread\n");
+        if (bot_cmd) {
+            bot_stop(&bot, &game);
+        }
+        pilot_free(&pilot);
+        renderer_free(&renderer);
+        cleanup_game(&game);
+        replay_writer_close(&recorder);
+        return 1;
+    }
     
     enable_raw_mode();
     hide_cursor();
     clear_screen();
     
-    init_game(&game, &config);
+    renderer.bands = active_perf ? NULL : frame_pool_start(&config);
+    unsigned char* cells = malloc((size_t)config.board_width * config.board_height);
+    OutBuf frame = {0};
     
     struct timespec start_time, current_time;
     clock_gettime(CLOCK_MONOTONIC, &start_time);
     long long last_render = 0;
     long long last_move = 0;
+    long long elapsed_us = 0;
+    long long idle_us = 0;
     
     while (!game.game_over) {
         clock_gettime(CLOCK_MONOTONIC, &current_time);
-        long long elapsed_us = (current_time.tv_sec - start_time.tv_sec) * 1000000LL + 
-                              (current_time.tv_nsec - start_time.tv_nsec) / 1000LL;
+        elapsed_us = (current_time.tv_sec - start_time.tv_sec) * 1000000LL + 
+                     (current_time.tv_nsec - start_time.tv_nsec) / 1000LL - idle_us;
         
-        handle_input(&game);
+        commands_applied += key_reader_poll(&reader, &game);
         
-        if (elapsed_us - last_move >= config.move_interval && !game.paused) {
+        if (elapsed_us - last_move >= config.move_interval && !game.paused && !game.game_over) {
+            if (pilot.policy) {
+                int direction = pilot_decide(&pilot, &game, &config);
+                command_queue_push(&commands, DIRECTION_KEYS[direction - 1], monotonic_us());
+            }
+            commands_applied += command_queue_apply(&commands, &game, monotonic_us(), &command_wait_us);
+            replay_writer_tick(&recorder, &game);
+            perf_enter(active_perf, PERF_PHASE_TICK);
             move_snake(&game, &config);
+            perf_leave(active_perf);
             last_move = elapsed_us;
         }
         
-        if (elapsed_us - last_render >= config.render_interval) {
-            draw_board(&game, &config);
+        int idle = game.paused && !game.game_over;
+        if (idle || elapsed_us - last_render >= config.render_interval) {
+            perf_enter(active_perf, PERF_PHASE_RENDER);
+            fill_cells(&game, &config, cells);
+            frame.len = 0;
+            render_frame(&renderer, &game, &config, cells, &frame);
+            perf_leave(active_perf);
+            fflush(stdout);
+            frame_write(STDOUT_FILENO, &frame, renderer.bands);
             last_render = elapsed_us;
         }
         
-        usleep(LOOP_SLEEP_US);
+        if (idle) {
+            idle_us += wait_for_input(reader.wake[0]);
+            last_render = -config.render_interval;
+        } else {
+            usleep(LOOP_SLEEP_US);
+        }
     }
+    key_reader_stop(&reader);
     
+    if (bot_cmd) {
+        bot_stop(&bot, &game);
+    }
     cleanup_game(&game);
     clear_screen();
     show_cursor();
     
+    int result = replay_writer_close(&recorder);
     printf("Game Over! Final Score: %d\n", game.score);
+    if (elapsed_us > 0) {
+        printf("Output: %lld bytes in %lld frames (%lld bytes/s)\n", renderer.bytes, renderer.frames,
+               renderer.bytes * MICROSECONDS_PER_SECOND / elapsed_us);
+    }
+    if (commands_applied > 0 || commands.drops > 0) {
+        printf("Input: %lld commands, %lld dropped, max queue depth %zu, average wait %lld us\n",
+               commands_applied, commands.drops, commands.max_depth,
+               commands_applied ? command_wait_us / commands_applied : 0);
+    }
+    pilot_report(&pilot);
+    perf_report(active_perf);
+    perf_close(active_perf);
+    pilot_free(&pilot);
+    renderer_free(&renderer);
+    outbuf_free(&frame);
+    free(cells);
     printf("Press Enter to exit...");
     
     disable_raw_mode();
     getchar();
     
-    return 0;
+    return result;
 }
\ No newline at end of file